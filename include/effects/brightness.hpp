@@ -7,4 +7,11 @@
 // delta: positive values increase brightness, negative values decrease brightness
 cv::Mat adjustBrightness(const cv::Mat& src, int delta);
 
+// Writes the adjusted image into dst, reusing dst's buffer when it already
+// has the right size and type (dst may be src itself)
+void adjustBrightness(const cv::Mat& src, cv::Mat& dst, int delta);
+
+// Adjusts the brightness of an image without allocating a new one
+void adjustBrightnessInPlace(cv::Mat& img, int delta);
+
 #endif // BRIGHTNESS_HPP
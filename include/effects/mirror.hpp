@@ -9,4 +9,13 @@ cv::Mat mirrorHorizontal(const cv::Mat& src);
 // Creates a vertically mirrored version of an image
 cv::Mat mirrorVertical(const cv::Mat& src);
 
+// Output-parameter versions: dst's buffer is reused when it already has the
+// right size and type (dst may be src itself)
+void mirrorHorizontal(const cv::Mat& src, cv::Mat& dst);
+void mirrorVertical(const cv::Mat& src, cv::Mat& dst);
+
+// Mirror an image without allocating a new one
+void mirrorHorizontalInPlace(cv::Mat& img);
+void mirrorVerticalInPlace(cv::Mat& img);
+
 #endif // MIRROR_HPP
@@ -6,4 +6,11 @@
 // Creates the negative version of an image
 cv::Mat createNegative(const cv::Mat& src);
 
+// Writes the negative of src into dst, reusing dst's buffer when it already
+// has the right size and type (dst may be src itself)
+void createNegative(const cv::Mat& src, cv::Mat& dst);
+
+// Replaces an image by its negative
+void createNegativeInPlace(cv::Mat& img);
+
 #endif // NEGATIVE_HPP
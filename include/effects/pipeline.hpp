@@ -0,0 +1,43 @@
+#ifndef PIPELINE_HPP
+#define PIPELINE_HPP
+
+#include <opencv2/opencv.hpp>
+#include <vector>
+
+// Chains several effects and applies them in a single pass over the image.
+// Geometric effects (mirror, rotate) are folded into one source-coordinate
+// mapping and point effects (negative, brightness) into one lookup table,
+// so the whole chain costs one read of the source and one write of the result.
+class EffectPipeline {
+public:
+    // Effects are applied in the order they are added
+    void addNegative();
+    void addBrightness(int delta);
+    void addMirrorHorizontal();
+    void addMirrorVertical();
+    // rotations: number of 90-degree clockwise rotations (can be negative)
+    void addRotate(int rotations);
+
+    bool empty() const { return steps.empty(); }
+    size_t size() const { return steps.size(); }
+
+    // Applies the whole chain to an 8-bit grayscale or BGR image
+    cv::Mat apply(const cv::Mat& src) const;
+
+    // Output-parameter version: dst's buffer is reused when it already has the
+    // right size and type. dst may be src itself; chains that move pixels then
+    // go through a temporary.
+    void apply(const cv::Mat& src, cv::Mat& dst) const;
+
+private:
+    enum class StepType { NEGATIVE, BRIGHTNESS, MIRROR_H, MIRROR_V, ROTATE };
+
+    struct Step {
+        StepType type;
+        int param;
+    };
+
+    std::vector<Step> steps;
+};
+
+#endif // PIPELINE_HPP
@@ -10,4 +10,12 @@ cv::Mat rotate90(const cv::Mat& src);
 // rotations: number of 90-degree rotations (can be negative)
 cv::Mat rotateMultiple90(const cv::Mat& src, int rotations);
 
+// Output-parameter version: dst's buffer is reused when it already has the
+// right size and type. dst may be src itself; 90/270 degrees then need a
+// temporary because the shape changes.
+void rotateMultiple90(const cv::Mat& src, cv::Mat& dst, int rotations);
+
+// Rotates an image by 180 degrees without allocating a new one
+void rotate180InPlace(cv::Mat& img);
+
 #endif // ROTATE_HPP
@@ -0,0 +1,24 @@
+#ifndef FRAME_STREAM_HPP
+#define FRAME_STREAM_HPP
+
+#include <cstddef>
+#include <string>
+#include "effects/pipeline.hpp"
+
+// Applies a pipeline of effects to every frame of a stream.
+//
+// input:  a directory of images, an image sequence pattern understood by
+//         cv::VideoCapture (e.g. frames/%04d.png) or a video file
+// output: a directory (existing, or ending in '/', or whenever the input is a
+//         directory), an image sequence pattern containing a printf-style
+//         frame number, or a video file
+//
+// Decoding, effects and encoding run on three threads linked by bounded queues
+// of queueDepth frames, so frame N+1 is decoded while frame N is processed and
+// frame N-1 encoded. Frame buffers are recycled between the stages.
+bool processFrameStream(const std::string& input,
+                        const std::string& output,
+                        const EffectPipeline& pipeline,
+                        size_t queueDepth = 4);
+
+#endif // FRAME_STREAM_HPP
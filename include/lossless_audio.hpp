@@ -4,15 +4,30 @@
 #include <string>
 #include <cstdint>
 
+// Largest near-lossless error: the quantization step 2*maxError+1 is stored in 16 bits
+const uint32_t MAX_AUDIO_ERROR = 32767;
+
 /**
  * Encode a WAV file using Golomb coding of prediction residuals.
  * 
  * @param inWav Input WAV file path
  * @param outFile Output compressed file path
  * @param m Golomb parameter (0 = adaptive, >0 = fixed)
- * @param blockSamples Number of frames per block
- * @param predictorOrder Predictor order (0-3): 0=none, 1=1-tap, 2=2-tap, 3=3-tap
+ * @param blockSamples Number of frames per block (the largest block with
+ *                 variable block sizes)
+ * @param predictorOrder Predictor order (0-4): 0=none, 1=1-tap, 2=2-tap, 3=3-tap,
+ *                 4=sign-sign NLMS cascade (orders 256, 32, 16), adapted per sample
  * @param verbose Print progress/statistics
+ * @param maxError 0 = lossless; otherwise near-lossless, every decoded sample
+ *                 is within +-maxError of the original (up to MAX_AUDIO_ERROR)
+ * @param correctionFile Hybrid mode (needs maxError > 0): also write the
+ *                 correction stream that makes the near-lossless file lossless.
+ *                 Both files then use independent, randomly accessible blocks.
+ * @param minBlockSamples 0 = fixed blocks of blockSamples frames; otherwise
+ *                 the encoder picks each block's size, halving blockSamples
+ *                 down to minBlockSamples where the estimated cost drops
+ * @param longTermPrediction Search a pitch lag and gain per channel block and
+ *                 use them where they save bits (slower encoding)
  * @return true on success
  */
 bool encodeWavWithGolomb(const std::string& inWav, 
@@ -20,18 +35,26 @@ bool encodeWavWithGolomb(const std::string& inWav,
                          uint32_t m, 
                          uint32_t blockSamples,
                          uint32_t predictorOrder,
-                         bool verbose);
+                         bool verbose,
+                         uint32_t maxError = 0,
+                         const std::string& correctionFile = "",
+                         uint32_t minBlockSamples = 0,
+                         bool longTermPrediction = false);
 
 /**
  * Decode a Golomb-compressed file to WAV.
+ * Reads both the current (version 2) format and files from older encoders.
  * 
  * @param inFile Input compressed file path
  * @param outWav Output WAV file path
  * @param verbose Print progress/statistics
+ * @param correctionFile Correction stream of a hybrid file; without it a
+ *                 hybrid file decodes to its near-lossless version
  * @return true on success
  */
 bool decodeGolombToWav(const std::string& inFile, 
                        const std::string& outWav, 
-                       bool verbose);
+                       bool verbose,
+                       const std::string& correctionFile = "");
 
 #endif // LOSSLESS_CODEC_HPP
\ No newline at end of file
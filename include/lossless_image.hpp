@@ -13,16 +13,28 @@ enum class ImagePredictor {
     LEFT_AVG = 5,
     UP_AVG = 6,
     AVG = 7,
-    JPEG_LS = 8
+    JPEG_LS = 8,
+    PAETH = 9
 };
 
+// How encodeImage treats color (P6) input
+enum class ColorConversion {
+    NONE = 0,        // only grayscale (P5) input is accepted
+    LUMA_FAST = 1,   // Y = (77R + 150G + 29B) >> 8, as ppm_to_grayscale
+    LUMA_EXACT = 2   // Y = (299R + 587G + 114B) / 1000, as ppm_to_grayscale -exact
+};
+
+// near = 0 is lossless. near > 0 (up to 127) is JPEG-LS style near-lossless
+// coding: every decoded pixel is within +-near of the original.
 bool encodeImage(const std::string& inputImage,
                  const std::string& outputFile,
                  ImagePredictor predictor,
                  uint32_t m,
                  uint32_t blockSize,
                  bool verbose,
-                 bool autoSelectPredictor = false);
+                 bool autoSelectPredictor = false,
+                 ColorConversion colorConversion = ColorConversion::NONE,
+                 uint32_t near = 0);
 
 bool decodeImage(const std::string& inputFile,
                  const std::string& outputImage,
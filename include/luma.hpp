@@ -0,0 +1,28 @@
+#ifndef LUMA_HPP
+#define LUMA_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * Convert packed 8-bit RGB pixels to 8-bit luma.
+ *
+ * fast : Y = (77R + 150G + 29B) >> 8
+ * exact: Y = floor((299R + 587G + 114B) / 1000)
+ *
+ * Uses SSSE3 when the CPU supports it, with identical results.
+ *
+ * @param rgb Input pixels (3 bytes each, R first)
+ * @param gray Output luma (1 byte per pixel)
+ * @param count Number of pixels
+ * @param exact Use the exact Rec.601 weights instead of the 8-bit ones
+ */
+void rgbToGray8(const uint8_t* rgb, uint8_t* gray, size_t count, bool exact);
+
+/**
+ * Same conversion for 16-bit big-endian samples (PPM with maxval > 255).
+ * Output samples are 16-bit big-endian too.
+ */
+void rgbToGray16(const uint8_t* rgb, uint8_t* gray, size_t count, bool exact);
+
+#endif // LUMA_HPP
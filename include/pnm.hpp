@@ -0,0 +1,149 @@
+#ifndef PNM_HPP
+#define PNM_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Netpbm flavours handled by the reader and writer
+enum class PnmFormat {
+    PGM = 5,   // P5, binary grayscale
+    PPM = 6,   // P6, binary RGB
+    PAM = 7    // P7, arbitrary depth with a tuple type
+};
+
+// Where PnmReader gets its bytes from (plain file or gzip decompressor)
+class PnmSource;
+
+struct PnmHeader {
+    PnmFormat format = PnmFormat::PGM;
+    uint32_t width = 0;
+    uint32_t height = 0;
+    uint32_t depth = 1;        // samples per pixel (1 for P5, 3 for P6)
+    uint32_t maxval = 255;     // samples above 255 take two bytes, big-endian
+    std::string tupleType;     // P7 only, e.g. "GRAYSCALE" or "RGB"
+
+    size_t bytesPerSample() const { return maxval > 255 ? 2 : 1; }
+    size_t rowBytes() const { return static_cast<size_t>(width) * depth * bytesPerSample(); }
+    size_t imageBytes() const { return rowBytes() * height; }
+};
+
+/**
+ * Streaming PNM reader.
+ *
+ * Headers are parsed straight from an internal buffer (comments allowed
+ * anywhere whitespace is), and the raster is handed out row by row, so
+ * images of any size can be processed in bounded memory. A file may hold
+ * several images back to back; nextImage() moves to the following one.
+ *
+ * gzip-compressed files (detected by their magic bytes) are decompressed
+ * transparently on a helper thread that runs ahead of the caller, when the
+ * library is built with zlib.
+ *
+ * Every method returns false on failure and error() describes the problem.
+ */
+class PnmReader {
+public:
+    PnmReader();
+    ~PnmReader();
+
+    PnmReader(const PnmReader&) = delete;
+    PnmReader& operator=(const PnmReader&) = delete;
+
+    bool open(const std::string& path);
+    void close();
+
+    /**
+     * Parse the header of the next image in the stream.
+     * Rows of the current image that were not read are skipped.
+     * Returns false at the end of the stream (error() is then empty) or
+     * if the header is invalid.
+     */
+    bool nextImage(PnmHeader& header);
+
+    /**
+     * Read the next rows of the current image (header.rowBytes() each).
+     * Fails if the image has fewer rows left or the file is truncated.
+     */
+    bool readRows(uint8_t* dst, uint32_t rows);
+
+    // Read all remaining rows of the current image into data
+    bool readImage(std::vector<uint8_t>& data);
+
+    uint32_t rowsLeft() const { return remainingRows; }
+    const std::string& error() const { return lastError; }
+
+private:
+    bool fill();
+    int peekByte();
+    int getByte();
+    void skipSpaceAndComments();
+    bool skipBytes(size_t count);
+    bool readNumber(uint32_t& value, const char* field);
+    bool readWord(std::string& word);
+    bool readBytes(uint8_t* dst, size_t count);
+    bool parseClassicHeader(PnmHeader& header);
+    bool parsePamHeader(PnmHeader& header);
+    bool fail(const std::string& message);
+    bool failEndOfData();
+
+    std::unique_ptr<PnmSource> source;
+    std::vector<uint8_t> buffer;
+    size_t pos = 0;
+    size_t end = 0;
+
+    PnmHeader current;
+    uint32_t remainingRows = 0;
+    std::string lastError;
+};
+
+/**
+ * Buffered PNM writer.
+ *
+ * Output is collected in a large buffer and written in big chunks; row data
+ * bigger than the buffer goes to the file directly. Several images can be
+ * written to the same file by calling writeHeader() again after the last row.
+ */
+class PnmWriter {
+public:
+    PnmWriter();
+    ~PnmWriter();
+
+    PnmWriter(const PnmWriter&) = delete;
+    PnmWriter& operator=(const PnmWriter&) = delete;
+
+    bool open(const std::string& path);
+
+    // P5/P6 headers use the classic "P5\n<w> <h>\n<maxval>\n" layout
+    bool writeHeader(const PnmHeader& header);
+    bool writeRows(const uint8_t* src, uint32_t rows);
+
+    // Flushes the buffer and closes the file
+    bool close();
+
+    const std::string& error() const { return lastError; }
+
+private:
+    bool flush();
+    bool writeBytes(const uint8_t* src, size_t count);
+    bool fail(const std::string& message);
+
+    std::FILE* file = nullptr;
+    std::vector<uint8_t> buffer;
+    size_t used = 0;
+
+    PnmHeader current;
+    uint32_t remainingRows = 0;
+    std::string lastError;
+};
+
+// Whole-image helpers for the common single-image case
+bool readPnm(const std::string& path, PnmHeader& header, std::vector<uint8_t>& data,
+             std::string& error);
+bool writePnm(const std::string& path, const PnmHeader& header, const uint8_t* data,
+              std::string& error);
+
+#endif // PNM_HPP
@@ -86,6 +86,28 @@ void BitStream::write_string(const string& s) {
 	write_n_bits('\n', 8); // Mark the end of the string with a newline
 }
 
+// Moves to the next byte boundary: the writer pads the current byte with
+// zeros, the reader skips what is left of it. A no-op when already aligned.
+void BitStream::align() {
+	if(m_rw_status) {
+		m_bit_ptr = 0;
+	} else if(m_bit_ptr != 7) {
+		m_byte_stream.put(m_buf);
+		m_bit_ptr = 7;
+		m_buf = 0;
+	}
+}
+
+// Raw byte blocks, copied straight to or from the byte stream. Only valid
+// on a byte boundary, i.e. right after align().
+void BitStream::write_bytes(const uint8_t* src, size_t n) {
+	m_byte_stream.write(src, n);
+}
+
+size_t BitStream::read_bytes(uint8_t* dst, size_t n) {
+	return m_byte_stream.read(dst, n);
+}
+
 off_t BitStream::tell() {
 	return m_byte_stream.tell();
 }
@@ -45,6 +45,9 @@ class BitStream {
 	void write_bit(int bit);
 	void write_n_bits(uint64_t bits, int n);
 	void write_string(const std::string& s);
+	void align();
+	void write_bytes(const uint8_t* src, size_t n);
+	size_t read_bytes(uint8_t* dst, size_t n);
 	off_t tell();
 	void close();
 };
@@ -16,6 +16,8 @@
 //
 //-------------------------------------------------------------------------------------------
 
+#include <algorithm>
+#include <cstring>
 #include "byte_stream.h"
 
 using namespace std;
@@ -67,6 +69,54 @@ int ByteStream::get() {
 	return *m_buf_ptr++;
 }
 
+//---------------------------------------------------------------------------------
+//
+// Block version of put()
+//
+void ByteStream::write(const uint8_t* src, size_t n) {
+	while(n > 0) {
+		size_t k = min(n, static_cast<size_t>(m_buf_limit - m_buf_ptr));
+		memcpy(m_buf_ptr, src, k);
+		m_buf_ptr += k;
+		m_tell += k;
+		src += k;
+		n -= k;
+
+		if(m_buf_ptr == m_buf_limit) { // buffer is full: write it
+			m_fs.write((char*)m_buf, BYTE_STREAM_BUF_SIZE);
+			m_buf_ptr = m_buf;
+		}
+	}
+}
+
+//---------------------------------------------------------------------------------
+//
+// Block version of get(): returns the number of bytes read, less than n at EOF
+//
+size_t ByteStream::read(uint8_t* dst, size_t n) {
+	size_t done = 0;
+	while(done < n) {
+		if(m_buf_ptr == m_buf_limit) { // buffer is empty: get another block
+			m_fs.read((char*)m_buf, BYTE_STREAM_BUF_SIZE);
+			if((m_size = m_fs.gcount()) == 0)
+				break;
+
+			m_buf_ptr = m_buf;
+		}
+
+		size_t k = min(n - done, static_cast<size_t>(m_buf + m_size - m_buf_ptr));
+		if(k == 0)
+			break;
+
+		memcpy(dst + done, m_buf_ptr, k);
+		m_buf_ptr += k;
+		m_tell += k;
+		done += k;
+	}
+
+	return done;
+}
+
 //---------------------------------------------------------------------------------
 //
 // m_buf_ptr points to a free buffer position
@@ -47,6 +47,8 @@ class ByteStream {
 
 	void put(int c);
 	int get();
+	void write(const uint8_t* src, size_t n);
+	size_t read(uint8_t* dst, size_t n);
 	void flush();
 	off_t tell();
 	void close();
@@ -0,0 +1,190 @@
+#ifndef LOSSY_CODEC_COMMON_H
+#define LOSSY_CODEC_COMMON_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Version 2 stream: "DCT2", sample rate, frames, block size, quantization,
+// block count, then the byte size of every block followed by the blocks,
+// each starting on a byte boundary. Version 1 streams start directly with
+// the sample rate, which can never equal a magic.
+const uint32_t DCT2_MAGIC = 0x44435432;
+
+// Version 3 adds block switching: the short block size follows the block
+// size in the header, and every block starts with a type bit (0 = one long
+// transform, 1 = block size / short block size short transforms)
+const uint32_t DCT3_MAGIC = 0x44435433;
+
+// Psychoacoustic weighting - reduce quantization for perceptually important
+// frequencies
+inline double get_weight(int index, int block_size) {
+    double freq_ratio = static_cast<double>(index) / block_size;
+
+    if (freq_ratio < 0.1)
+        return 0.5;
+    else if (freq_ratio < 0.3)
+        return 1.0;
+    else if (freq_ratio < 0.5)
+        return 1.5;
+    else
+        return 2.5;
+}
+
+// Default worker count: one per hardware thread
+inline unsigned default_threads() {
+    return std::max(1u, std::thread::hardware_concurrency());
+}
+
+// Fixed set of worker threads, started once and reused for every batch of
+// blocks. parallel_for() runs task(i) for every i in [0, count) on the
+// workers and the calling thread. Blocks are claimed one at a time from a
+// shared counter, so the pool stays busy even when some blocks take longer
+// than others.
+class ThreadPool {
+  public:
+    explicit ThreadPool(unsigned threads) {
+        for (unsigned t = 1; t < threads; t++)
+            m_workers.emplace_back([this]() { work(); });
+    }
+
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stop = true;
+        }
+        m_wake.notify_all();
+        for (std::thread &t : m_workers)
+            t.join();
+    }
+
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    template <typename Task> void parallel_for(size_t count, Task task) {
+        std::function<void(size_t)> job = std::ref(task);
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_task = &job;
+            m_count = count;
+            m_next = 0;
+            m_busy = m_workers.size();
+            m_generation++;
+        }
+        m_wake.notify_all();
+        run();
+
+        // The workers must be done with `job` before it goes out of scope
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_done.wait(lock, [this]() { return m_busy == 0; });
+        m_task = nullptr;
+    }
+
+  private:
+    void run() {
+        for (size_t i; (i = m_next++) < m_count;)
+            (*m_task)(i);
+    }
+
+    void work() {
+        uint64_t seen = 0;
+        std::unique_lock<std::mutex> lock(m_mutex);
+        for (;;) {
+            m_wake.wait(lock, [&]() { return m_stop || m_generation != seen; });
+            if (m_stop)
+                return;
+            seen = m_generation;
+
+            lock.unlock();
+            run();
+            lock.lock();
+            if (--m_busy == 0)
+                m_done.notify_one();
+        }
+    }
+
+    std::vector<std::thread> m_workers;
+    std::mutex m_mutex;
+    std::condition_variable m_wake; // a new batch, or shutdown
+    std::condition_variable m_done; // the last worker finished the batch
+    const std::function<void(size_t)> *m_task = nullptr;
+    size_t m_count = 0;
+    std::atomic<size_t> m_next{0};
+    size_t m_busy = 0;
+    uint64_t m_generation = 0;
+    bool m_stop = false;
+};
+
+// In-memory counterparts of BitStream, one per block, so that blocks can be
+// coded on different threads. Same bit order (MSB first) as BitStream.
+class BlockBitWriter {
+  public:
+    void write_bit(int bit) { write_n_bits(bit & 0x01, 1); }
+
+    // n <= 32
+    void write_n_bits(uint64_t bits, int n) {
+        m_acc = (m_acc << n) | (bits & ((uint64_t(1) << n) - 1));
+        m_fill += n;
+        while (m_fill >= 8) {
+            m_fill -= 8;
+            m_bytes.push_back(static_cast<uint8_t>(m_acc >> m_fill));
+        }
+    }
+
+    // Pads the last byte with zeros
+    const std::vector<uint8_t> &flush() {
+        if (m_fill > 0) {
+            m_bytes.push_back(static_cast<uint8_t>(m_acc << (8 - m_fill)));
+            m_fill = 0;
+        }
+        return m_bytes;
+    }
+
+  private:
+    std::vector<uint8_t> m_bytes;
+    uint64_t m_acc = 0;
+    int m_fill = 0;
+};
+
+class BlockBitReader {
+  public:
+    BlockBitReader(const uint8_t *data, size_t size)
+        : m_data(data), m_bits(size * 8) {}
+
+    int read_bit() {
+        if (m_pos >= m_bits) {
+            m_overrun = true;
+            return EOF;
+        }
+        int bit = (m_data[m_pos >> 3] >> (7 - (m_pos & 7))) & 0x01;
+        m_pos++;
+        return bit;
+    }
+
+    // Bits past the end read as zeros; see overrun()
+    uint64_t read_n_bits(int n) {
+        uint64_t x = 0;
+        for (int i = 0; i < n; i++) {
+            int bit = read_bit();
+            x = (x << 1) | (bit == EOF ? 0 : bit);
+        }
+        return x;
+    }
+
+    // True once a read went past the end of the block
+    bool overrun() const { return m_overrun; }
+
+  private:
+    const uint8_t *m_data;
+    size_t m_bits;
+    size_t m_pos = 0;
+    bool m_overrun = false;
+};
+
+#endif
@@ -1,63 +1,253 @@
 #include "bit_stream.h"
+#include "lossy_codec_common.h"
 #include <algorithm>
 #include <cmath>
+#include <cstdlib>
 #include <fstream>
 #include <iostream>
 #include <sndfile.h>
+#include <string>
 #include <vector>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 using namespace std;
 
-// Inverse DCT (DCT Type-III)
-void idct(const vector<double> &input, vector<double> &output) {
-    int N = input.size();
-    output.resize(N);
+// Per block size tables, built once before any block is decoded. They hold
+// exactly the values the direct formulas produce, so the output does not
+// depend on them.
+struct IdctTables {
+    int size;
+    vector<double> basis; // row k: cos(pi * k * (n + 0.5) / N)
+    vector<double> scale; // sqrt(1/N) for k = 0, sqrt(2/N) otherwise
+    vector<double> step;  // base_step * weight of every coefficient
+};
+
+IdctTables make_tables(int N, double base_step) {
+    IdctTables tables{N, vector<double>(size_t(N) * N), vector<double>(N),
+                      vector<double>(N)};
+
+    for (int k = 0; k < N; k++) {
+        for (int n = 0; n < N; n++)
+            tables.basis[size_t(k) * N + n] = cos(M_PI * k * (n + 0.5) / N);
+        tables.scale[k] = (k == 0) ? sqrt(1.0 / N) : sqrt(2.0 / N);
+        tables.step[k] = base_step * get_weight(k, N);
+    }
 
-    for (int n = 0; n < N; n++) {
-        double sum = 0.0;
+    return tables;
+}
 
-        for (int k = 0; k < N; k++) {
-            double scale = (k == 0) ? sqrt(1.0 / N) : sqrt(2.0 / N);
-            sum += scale * input[k] * cos(M_PI * k * (n + 0.5) / N);
+// Dequantize with psychoacoustic weighting, then inverse DCT (DCT Type-III).
+// Every output sample still sums its terms in coefficient order; the loop
+// runs over the samples innermost so that they are computed side by side.
+void dequantize_idct(const vector<int32_t> &quantized, const IdctTables &tables,
+                     double energy_factor, vector<double> &output) {
+    int N = tables.size;
+    output.assign(N, 0.0);
+
+    for (int k = 0; k < N; k++) {
+        if (quantized[k] == 0)
+            continue; // adds exact zeros
+        double coeff = quantized[k] * (tables.step[k] * energy_factor);
+        double term = tables.scale[k] * coeff;
+        const double *row = &tables.basis[size_t(k) * N];
+        int n = 0;
+#ifdef __SSE2__
+        __m128d t = _mm_set1_pd(term);
+        for (; n + 2 <= N; n += 2) {
+            __m128d acc = _mm_loadu_pd(&output[n]);
+            acc = _mm_add_pd(acc, _mm_mul_pd(t, _mm_loadu_pd(row + n)));
+            _mm_storeu_pd(&output[n], acc);
         }
+#endif
+        for (; n < N; n++)
+            output[n] += term * row[n];
+    }
+}
+
+// Reads the energy factor and coefficients of one block, from the file
+// (BitStream, version 1) or from a block buffer (BlockBitReader, later
+// versions).
+// Returns false at the end of the stream.
+template <typename Reader>
+bool read_block(Reader &in, vector<int32_t> &quantized, double &energy_factor) {
+    uint16_t energy_enc = in.read_n_bits(16);
+    if (energy_enc == 0)
+        return false; // EOF check
+    energy_factor = energy_enc / 1000.0;
+
+    for (size_t i = 0; i < quantized.size(); i++) {
+        int sign_bit = in.read_bit();
+        if (sign_bit == EOF)
+            return false;
 
-        output[n] = sum;
+        int bits_needed = in.read_n_bits(5);
+        if (bits_needed == 0)
+            bits_needed = 1;
+
+        uint64_t magnitude = in.read_n_bits(bits_needed);
+
+        quantized[i] = (sign_bit == 1) ? -static_cast<int32_t>(magnitude)
+                                       : static_cast<int32_t>(magnitude);
     }
+
+    return true;
 }
 
-// Psychoacoustic weighting (same as encoder)
-double get_weight(int index, int block_size) {
-    double freq_ratio = static_cast<double>(index) / block_size;
-
-    if (freq_ratio < 0.1)
-        return 0.5;
-    else if (freq_ratio < 0.3)
-        return 1.0;
-    else if (freq_ratio < 0.5)
-        return 1.5;
-    else
-        return 2.5;
+// Dequantizes and inverse transforms one block into samples
+void reconstruct_block(const vector<int32_t> &quantized, const IdctTables &tables,
+                       double energy_factor, vector<double> &samples) {
+    dequantize_idct(quantized, tables, energy_factor, samples);
+
+    for (double &s : samples) {
+        if (s > 1.0)
+            s = 1.0;
+        if (s < -1.0)
+            s = -1.0;
+    }
 }
 
-// Dequantize with psychoacoustic weighting
-void dequantize_weighted(const vector<int32_t> &quantized,
-                         vector<double> &dct_coeffs, double base_step,
-                         double energy_factor) {
-    dct_coeffs.resize(quantized.size());
+// Decodes one version 2 or 3 block into block size samples at `output`.
+// Version 3 blocks (short_tables set) start with their type bit.
+bool decode_block(BlockBitReader &reader, const IdctTables &long_tables,
+                  const IdctTables *short_tables, double *output) {
+    const IdctTables *tables = &long_tables;
+    int transforms = 1;
+    if (short_tables && reader.read_bit() == 1) {
+        tables = short_tables;
+        transforms = long_tables.size / short_tables->size;
+    }
 
-    for (size_t i = 0; i < quantized.size(); i++) {
-        double weight = get_weight(i, quantized.size());
-        double adaptive_step = base_step * weight * energy_factor;
-        dct_coeffs[i] = quantized[i] * adaptive_step;
+    vector<int32_t> quantized(tables->size);
+    vector<double> block_samples;
+    for (int t = 0; t < transforms; t++) {
+        double energy_factor;
+        if (!read_block(reader, quantized, energy_factor) || reader.overrun())
+            return false;
+
+        reconstruct_block(quantized, *tables, energy_factor, block_samples);
+        copy(block_samples.begin(), block_samples.end(),
+             output + t * tables->size);
     }
+
+    return true;
+}
+
+// Versions 2 and 3: reads the block size table, then only the blocks that
+// overlap frames [first_frame, end_frame), found from the table. Decodes
+// them on a pool of `threads` threads and writes the frames in order.
+bool decode_blocks(BitStream &ibs, fstream &ifs, uint32_t total_frames,
+                   const IdctTables &long_tables, const IdctTables *short_tables,
+                   size_t first_frame, size_t end_frame, unsigned threads,
+                   SNDFILE *outfile) {
+    size_t block_size = long_tables.size;
+    size_t num_blocks = ibs.read_n_bits(32);
+    if (num_blocks != (total_frames + block_size - 1) / block_size) {
+        cerr << "Error: " << num_blocks << " blocks do not match "
+             << total_frames << " frames\n";
+        return false;
+    }
+
+    // The table is byte aligned: read it in one go
+    vector<uint8_t> table(4 * num_blocks);
+    if (ibs.read_bytes(table.data(), table.size()) != table.size()) {
+        cerr << "Error: truncated input file\n";
+        return false;
+    }
+    off_t data_start = ibs.tell();
+
+    vector<size_t> offsets(num_blocks + 1, 0);
+    for (size_t b = 0; b < num_blocks; b++) {
+        const uint8_t *entry = &table[4 * b];
+        uint32_t size = uint32_t(entry[0]) << 24 | uint32_t(entry[1]) << 16 |
+                        uint32_t(entry[2]) << 8 | entry[3];
+        // A block never takes more than about 26 bits per sample
+        if (size > 4 * block_size) {
+            cerr << "Error: corrupt block size table\n";
+            return false;
+        }
+        offsets[b + 1] = offsets[b] + size;
+    }
+
+    size_t first_block = first_frame / block_size;
+    size_t end_block = (end_frame + block_size - 1) / block_size;
+    size_t count = end_block - first_block;
+
+    // The blocks of the range are contiguous: one seek, then a batch of
+    // threads * 4 blocks at a time is read, decoded and written, so memory
+    // does not grow with the length of the range
+    ifs.clear();
+    ifs.seekg(data_start + static_cast<off_t>(offsets[first_block]));
+
+    const size_t batch_blocks = threads * 4;
+    vector<uint8_t> data;
+    vector<double> samples(batch_blocks * block_size);
+    sf_count_t written = 0;
+    ThreadPool pool(threads);
+
+    for (size_t first = first_block; first < end_block; first += batch_blocks) {
+        size_t batch = min(batch_blocks, end_block - first);
+        data.resize(offsets[first + batch] - offsets[first]);
+        ifs.read(reinterpret_cast<char *>(data.data()), data.size());
+        if (static_cast<size_t>(ifs.gcount()) != data.size()) {
+            cerr << "Error: truncated input file\n";
+            return false;
+        }
+
+        atomic<bool> ok{true};
+        pool.parallel_for(batch, [&](size_t i) {
+            size_t b = first + i;
+            BlockBitReader reader(data.data() + offsets[b] - offsets[first],
+                                  offsets[b + 1] - offsets[b]);
+            if (!decode_block(reader, long_tables, short_tables,
+                              &samples[i * block_size]))
+                ok = false;
+        });
+
+        if (!ok) {
+            cerr << "Error: corrupt block data\n";
+            return false;
+        }
+
+        // Frames of the batch inside the requested range
+        size_t batch_start = first * block_size;
+        size_t from = max(batch_start, first_frame);
+        size_t to = min(batch_start + batch * block_size, end_frame);
+        written += sf_write_double(outfile, &samples[from - batch_start], to - from);
+    }
+
+    cout << "Decoding complete.\n";
+    cout << "Processed " << count << " of " << num_blocks << " blocks on "
+         << threads << " thread(s)\n";
+    cout << "Reconstructed " << written << " frames\n";
+    return true;
 }
 
 int main(int argc, char *argv[]) {
     if (argc < 3) {
-        cerr << "Usage: " << argv[0] << " input.dct output.wav\n";
+        cerr << "Usage: " << argv[0]
+             << " input.dct output.wav [-t threads] [--from seconds]"
+                " [--to seconds]\n";
         return 1;
     }
 
+    unsigned threads = default_threads();
+    double from_seconds = 0.0;
+    double to_seconds = -1.0; // < 0 = up to the end
+    for (int i = 3; i < argc; i++) {
+        if (string(argv[i]) == "-t" && i + 1 < argc) {
+            threads = max(1, atoi(argv[++i]));
+        } else if (string(argv[i]) == "--from" && i + 1 < argc) {
+            from_seconds = atof(argv[++i]);
+        } else if (string(argv[i]) == "--to" && i + 1 < argc) {
+            to_seconds = atof(argv[++i]);
+        } else {
+            cerr << "Unknown option: " << argv[i] << "\n";
+            return 1;
+        }
+    }
+
     fstream ifs(argv[1], ios::in | ios::binary);
     if (!ifs.is_open()) {
         cerr << "Error opening input file\n";
@@ -66,15 +256,44 @@ int main(int argc, char *argv[]) {
 
     BitStream ibs(ifs, STREAM_READ);
 
-    uint32_t samplerate = ibs.read_n_bits(32);
+    // Version 1 files have no magic and start with the sample rate
+    uint32_t first_word = ibs.read_n_bits(32);
+    int version = first_word == DCT3_MAGIC   ? 3
+                  : first_word == DCT2_MAGIC ? 2
+                                             : 1;
+    uint32_t samplerate = version > 1 ? ibs.read_n_bits(32) : first_word;
     uint32_t total_frames = ibs.read_n_bits(32);
     uint16_t block_size = ibs.read_n_bits(16);
+    uint16_t short_block_size = version > 2 ? ibs.read_n_bits(16) : 0;
     uint32_t quant_fixed = ibs.read_n_bits(32);
     double base_quant = quant_fixed / 1000000.0;
 
+    if (block_size == 0) {
+        cerr << "Error: invalid block size\n";
+        return 1;
+    }
+    if (version > 2 &&
+        (short_block_size == 0 || block_size % short_block_size != 0)) {
+        cerr << "Error: invalid short block size\n";
+        return 1;
+    }
+
+    // Requested range in frames, clipped to the signal
+    size_t first_frame = static_cast<size_t>(
+        min<double>(total_frames, max(0.0, from_seconds) * samplerate));
+    size_t end_frame = to_seconds < 0 ? total_frames
+                                      : static_cast<size_t>(min<double>(
+                                            total_frames, to_seconds * samplerate));
+    if (end_frame <= first_frame && total_frames > 0) {
+        cerr << "Error: empty time range\n";
+        return 1;
+    }
+
     cout << "Sample rate: " << samplerate << " Hz\n";
     cout << "Total frames: " << total_frames << "\n";
     cout << "Block size: " << block_size << "\n";
+    if (version > 2)
+        cout << "Short block size: " << short_block_size << "\n";
     cout << "Base quantization: " << base_quant << "\n";
 
     SF_INFO sfinfo;
@@ -88,56 +307,47 @@ int main(int argc, char *argv[]) {
         return 1;
     }
 
+    IdctTables tables = make_tables(block_size, base_quant);
+
+    if (version > 1) {
+        IdctTables short_tables;
+        if (version > 2)
+            short_tables = make_tables(short_block_size, base_quant);
+        bool ok = decode_blocks(ibs, ifs, total_frames, tables,
+                                version > 2 ? &short_tables : nullptr,
+                                first_frame, end_frame, threads, outfile);
+        ibs.close();
+        sf_close(outfile);
+        if (!ok)
+            return 1;
+        cout << "Using adaptive dequantization and psychoacoustic weighting.\n";
+        return 0;
+    }
+
     vector<int32_t> quantized(block_size);
-    vector<double> dct_coeffs;
     vector<double> samples;
 
+    // Version 1 has no block index: every block up to the end of the range
+    // is parsed, and only the frames inside it are written
     long long frames_written = 0;
+    long long position = 0;
     int blocks_processed = 0;
 
-    while (frames_written < total_frames) {
-        uint16_t energy_enc = ibs.read_n_bits(16);
-        if (energy_enc == 0)
-            break; // EOF check
-        double energy_factor = energy_enc / 1000.0;
-
-        bool eof_reached = false;
-        for (int i = 0; i < block_size; i++) {
-            int sign_bit = ibs.read_bit();
-            if (sign_bit == EOF) {
-                eof_reached = true;
-                break;
-            }
-
-            int bits_needed = ibs.read_n_bits(5);
-            if (bits_needed == 0)
-                bits_needed = 1;
-
-            uint64_t magnitude = ibs.read_n_bits(bits_needed);
-
-            quantized[i] = (sign_bit == 1) ? -static_cast<int32_t>(magnitude)
-                                           : static_cast<int32_t>(magnitude);
-        }
-
-        if (eof_reached)
+    while (position < (long long)end_frame) {
+        double energy_factor;
+        if (!read_block(ibs, quantized, energy_factor))
             break;
 
-        dequantize_weighted(quantized, dct_coeffs, base_quant, energy_factor);
-
-        idct(dct_coeffs, samples);
-
-        for (double &s : samples) {
-            if (s > 1.0)
-                s = 1.0;
-            if (s < -1.0)
-                s = -1.0;
-        }
+        reconstruct_block(quantized, tables, energy_factor, samples);
 
-        long long to_write =
-            min((long long)block_size, total_frames - frames_written);
-        sf_count_t written = sf_write_double(outfile, samples.data(), to_write);
+        long long block_end = min(position + block_size, (long long)total_frames);
+        long long from = max(position, (long long)first_frame);
+        long long to = min(block_end, (long long)end_frame);
+        if (to > from)
+            frames_written +=
+                sf_write_double(outfile, samples.data() + (from - position), to - from);
 
-        frames_written += written;
+        position = block_end;
         blocks_processed++;
     }
 
@@ -1,76 +1,416 @@
 #include "bit_stream.h"
+#include "lossy_codec_common.h"
 #include <algorithm>
+#include <atomic>
 #include <cmath>
+#include <cstdlib>
+#include <filesystem>
 #include <fstream>
 #include <iostream>
+#include <optional>
 #include <sndfile.h>
+#include <string>
 #include <vector>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 using namespace std;
 
 const int BLOCK_SIZE = 1024;
 const double BASE_QUANTIZATION = 0.002;
 
-// DCT Type-II implementation
-void dct(const vector<double> &input, vector<double> &output) {
-    int N = input.size();
-    output.resize(N);
+// Coefficient magnitudes are coded in at most 20 bits. For input within
+// [-1, 1] a coefficient is at most rms * sqrt(BLOCK_SIZE) (Parseval), and the
+// energy factor is 10 * rms clamped to [0.5, 2], so coefficient / energy
+// factor stays below sqrt(BLOCK_SIZE) / 2 = 16. With the smallest weight
+// (0.5) a magnitude is then at most 32 / step, which fits for steps above
+// 32 / 2^20 (3.05e-5).
+const int MAX_MAGNITUDE_BITS = 20;
+const uint32_t MAX_MAGNITUDE = (1u << MAX_MAGNITUDE_BITS) - 1;
+const double MIN_BASE_QUANTIZATION = 0.000031;
+
+// Block switching: a block holding a transient is coded as SHORT_BLOCKS
+// transforms of SHORT_BLOCK_SIZE samples, so that quantization noise (pre-echo)
+// cannot spread over the quiet part before the attack
+const int SHORT_BLOCK_SIZE = 128;
+const int SHORT_BLOCKS = BLOCK_SIZE / SHORT_BLOCK_SIZE;
+const int TRANSIENT_HISTORY = 2;       // segments before the block looked at
+const double TRANSIENT_RATIO = 10.0;   // energy jump that counts as an attack
+const double TRANSIENT_FLOOR = 1.0e-4; // segment energy below which nothing is
+
+// Rate control: a block's quantization scale is 2^(s / SCALE_STEPS) for s in
+// [MIN_SCALE_STEP, MAX_SCALE_STEP]. It is folded into the energy factor of
+// each of its transforms, so decoders need nothing new.
+const int SCALE_STEPS = 8;
+const int MIN_SCALE_STEP = -6 * SCALE_STEPS;
+const int MAX_SCALE_STEP = 8 * SCALE_STEPS;
+const int RESERVOIR_BLOCKS = 8; // bit reservoir capacity, in average blocks
+
+// Per block size tables, built once before any block is coded
+struct DctTables {
+    int size;
+    vector<float> basis;    // row k: scale_k * cos(pi * k * (n + 0.5) / N)
+    vector<float> inv_step; // 1 / (base_step * weight) of every coefficient
+};
+
+DctTables make_tables(int N, double base_step) {
+    DctTables tables{N, vector<float>(size_t(N) * N), vector<float>(N)};
 
     for (int k = 0; k < N; k++) {
-        double sum = 0.0;
         double scale = (k == 0) ? sqrt(1.0 / N) : sqrt(2.0 / N);
+        for (int n = 0; n < N; n++)
+            tables.basis[size_t(k) * N + n] =
+                static_cast<float>(scale * cos(M_PI * k * (n + 0.5) / N));
+        tables.inv_step[k] =
+            static_cast<float>(1.0 / (base_step * get_weight(k, N)));
+    }
 
-        for (int n = 0; n < N; n++) {
-            sum += input[n] * cos(M_PI * k * (n + 0.5) / N);
-        }
-        output[k] = sum * scale;
+    return tables;
+}
+
+float dot_product(const float *a, const float *b, int n) {
+    int i = 0;
+    float sum = 0.0f;
+#ifdef __SSE2__
+    __m128 acc0 = _mm_setzero_ps();
+    __m128 acc1 = _mm_setzero_ps();
+    for (; i + 8 <= n; i += 8) {
+        acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+        acc1 = _mm_add_ps(acc1, _mm_mul_ps(_mm_loadu_ps(a + i + 4),
+                                           _mm_loadu_ps(b + i + 4)));
     }
+    float lanes[4];
+    _mm_storeu_ps(lanes, _mm_add_ps(acc0, acc1));
+    sum = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+#endif
+    for (; i < n; i++)
+        sum += a[i] * b[i];
+    return sum;
 }
 
-// Psychoacoustic weighting - reduce quantization for perceptually important
-// frequencies
-double get_weight(int index, int block_size) {
-    double freq_ratio = static_cast<double>(index) / block_size;
-
-    if (freq_ratio < 0.1)
-        return 0.5;
-    else if (freq_ratio < 0.3)
-        return 1.0;
-    else if (freq_ratio < 0.5)
-        return 1.5;
-    else
-        return 2.5;
+// DCT Type-II, one dot product with a precomputed basis row per coefficient
+void dct(const float *input, const DctTables &tables, float *output) {
+    int N = tables.size;
+    for (int k = 0; k < N; k++)
+        output[k] = dot_product(input, &tables.basis[size_t(k) * N], N);
 }
 
 // Calculate block energy for adaptive quantization
-double calculate_energy(const vector<double> &block) {
+double calculate_energy(const float *block, int N) {
     double energy = 0.0;
-    for (double val : block) {
-        energy += val * val;
+    for (int i = 0; i < N; i++) {
+        energy += double(block[i]) * block[i];
+    }
+    return sqrt(energy / N);
+}
+
+// Quantize with psychoacoustic weighting: multiplies by the reciprocal of
+// each coefficient's step, rounding to nearest
+void quantize_weighted(const float *dct_coeffs, const DctTables &tables,
+                       double energy_factor, int32_t *quantized) {
+    int N = tables.size;
+    float inv_energy = static_cast<float>(1.0 / energy_factor);
+    int i = 0;
+#ifdef __SSE2__
+    __m128 scale = _mm_set1_ps(inv_energy);
+    for (; i + 4 <= N; i += 4) {
+        __m128 step = _mm_mul_ps(_mm_loadu_ps(&tables.inv_step[i]), scale);
+        __m128 x = _mm_mul_ps(_mm_loadu_ps(dct_coeffs + i), step);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(quantized + i),
+                         _mm_cvtps_epi32(x));
+    }
+#endif
+    for (; i < N; i++)
+        quantized[i] = static_cast<int32_t>(
+            lrintf(dct_coeffs[i] * (tables.inv_step[i] * inv_energy)));
+}
+
+// Energy-based transient detector. Splits the block (and the end of the
+// previous one) into short block segments and measures the energy of the
+// first difference in each, which emphasizes the high frequencies of an
+// attack. A segment whose energy exceeds TRANSIENT_RATIO times the mean of
+// the segments before it marks the block as transient. `history` is the
+// number of samples available before the block.
+bool is_transient(const float *block, size_t history) {
+    int past = static_cast<int>(
+        min<size_t>(history / SHORT_BLOCK_SIZE, TRANSIENT_HISTORY));
+    const float *start = block - past * SHORT_BLOCK_SIZE;
+
+    double sum = 0.0;
+    for (int s = 0; s < past + SHORT_BLOCKS; s++) {
+        double energy = 0.0;
+        for (int n = s * SHORT_BLOCK_SIZE; n < (s + 1) * SHORT_BLOCK_SIZE; n++) {
+            double diff = n > 0 ? start[n] - start[n - 1] : 0.0;
+            energy += diff * diff;
+        }
+
+        if (s > 0 && s >= past && energy > TRANSIENT_FLOOR &&
+            energy > TRANSIENT_RATIO * sum / s)
+            return true;
+        sum += energy;
+    }
+
+    return false;
+}
+
+// A block after analysis: its transform coefficients and energy factors,
+// ready to be quantized at any scale. With rate control, also the block's
+// cost curve (see cost_steps()).
+struct AnalyzedBlock {
+    bool transient;
+    vector<float> coeffs;          // BLOCK_SIZE values, transform after transform
+    vector<double> energy_factors; // one per transform
+    vector<uint32_t> step_bits;    // step_bits[j]: cost at MAX_SCALE_STEP - j
+    bool finest_reached = false;   // no finer step than the last one fits
+};
+
+AnalyzedBlock analyze_block(const float *block, size_t history,
+                            const DctTables &long_tables,
+                            const DctTables &short_tables) {
+    AnalyzedBlock analyzed{is_transient(block, history),
+                           vector<float>(BLOCK_SIZE), {}, {}};
+    const DctTables &tables = analyzed.transient ? short_tables : long_tables;
+
+    for (int start = 0; start < BLOCK_SIZE; start += tables.size) {
+        double energy = calculate_energy(block + start, tables.size);
+        analyzed.energy_factors.push_back(max(0.5, min(2.0, energy * 10.0)));
+        dct(block + start, tables, &analyzed.coeffs[start]);
+    }
+
+    return analyzed;
+}
+
+// Energy factor as stored (in thousandths), with the rate control scale
+// folded in
+uint16_t energy_word(double energy_factor, double scale) {
+    return static_cast<uint16_t>(
+        max(1.0, min(65535.0, energy_factor * scale * 1000)));
+}
+
+// Magnitude bits of a coefficient: at least 1, at most MAX_MAGNITUDE_BITS
+// for magnitudes up to MAX_MAGNITUDE
+int magnitude_bits(uint32_t magnitude) {
+    int bits_needed = 0;
+    while (magnitude >> bits_needed)
+        bits_needed++;
+    return max(1, bits_needed);
+}
+
+// Bits of one transform's coefficients (sign, length, magnitude) at the
+// given energy factor, exactly as code_block() writes them, without
+// writing them. Sets `saturated` when a magnitude exceeds MAX_MAGNITUDE.
+size_t coefficient_bits(const float *dct_coeffs, const DctTables &tables,
+                        double energy_factor, bool &saturated) {
+    int N = tables.size;
+    float inv_energy = static_cast<float>(1.0 / energy_factor);
+    const float limit = MAX_MAGNITUDE + 0.5f; // rounds up past MAX_MAGNITUDE
+    size_t bits = 6 * size_t(N);
+    int i = 0;
+#ifdef __SSE2__
+    // The magnitude is |x| clipped to MAX_MAGNITUDE and rounded as in
+    // quantize_weighted(); its bit length is read from its exponent as a
+    // float (biased by 127, with zero taken as one)
+    const __m128 abs_mask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 max_magnitude = _mm_set1_ps(float(MAX_MAGNITUDE));
+    __m128 scale = _mm_set1_ps(inv_energy);
+    __m128 over = _mm_setzero_ps();
+    __m128i exponents = _mm_setzero_si128();
+    for (; i + 4 <= N; i += 4) {
+        __m128 step = _mm_mul_ps(_mm_loadu_ps(&tables.inv_step[i]), scale);
+        __m128 x = _mm_and_ps(_mm_mul_ps(_mm_loadu_ps(dct_coeffs + i), step),
+                              abs_mask);
+        over = _mm_or_ps(over, _mm_cmpge_ps(x, _mm_set1_ps(limit)));
+        __m128i magnitude = _mm_cvtps_epi32(_mm_min_ps(x, max_magnitude));
+        __m128 as_float = _mm_max_ps(_mm_cvtepi32_ps(magnitude), one);
+        exponents = _mm_add_epi32(
+            exponents, _mm_srli_epi32(_mm_castps_si128(as_float), 23));
     }
-    return sqrt(energy / block.size());
+    int32_t lanes[4];
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(lanes), exponents);
+    bits += size_t(lanes[0]) + lanes[1] + lanes[2] + lanes[3] - 126 * size_t(i);
+    if (_mm_movemask_ps(over))
+        saturated = true;
+#endif
+    for (; i < N; i++) {
+        float x = fabsf(dct_coeffs[i] * (tables.inv_step[i] * inv_energy));
+        if (x >= limit)
+            saturated = true;
+        bits += magnitude_bits(
+            static_cast<uint32_t>(lrintf(min(x, float(MAX_MAGNITUDE)))));
+    }
+    return bits;
 }
 
-// Quantize with psychoacoustic weighting
-void quantize_weighted(const vector<double> &dct_coeffs,
-                       vector<int32_t> &quantized, double base_step,
-                       double energy_factor) {
-    quantized.resize(dct_coeffs.size());
+// Codes one block, preceded by its type bit: 0 = one long transform,
+// 1 = SHORT_BLOCKS short ones. Every coefficient is quantized with the
+// energy factor exactly as the decoder will read it.
+void code_block(const AnalyzedBlock &block, const DctTables &long_tables,
+                const DctTables &short_tables, double scale,
+                BlockBitWriter &out) {
+    const DctTables &tables = block.transient ? short_tables : long_tables;
+    vector<int32_t> quantized(tables.size);
+
+    out.write_bit(block.transient);
+
+    for (size_t t = 0; t < block.energy_factors.size(); t++) {
+        uint16_t energy_enc = energy_word(block.energy_factors[t], scale);
+        quantize_weighted(&block.coeffs[t * tables.size], tables,
+                          energy_enc / 1000.0, quantized.data());
 
-    for (size_t i = 0; i < dct_coeffs.size(); i++) {
-        double weight = get_weight(i, dct_coeffs.size());
-        double adaptive_step = base_step * weight * energy_factor;
-        quantized[i] =
-            static_cast<int32_t>(round(dct_coeffs[i] / adaptive_step));
+        out.write_n_bits(energy_enc, 16);
+
+        for (int32_t coeff : quantized) {
+            // Saturated rather than truncated: input beyond full scale
+            // must not wrap around
+            uint32_t magnitude = coeff < 0 ? -static_cast<uint32_t>(coeff) : coeff;
+            magnitude = min(magnitude, MAX_MAGNITUDE);
+            int bits_needed = magnitude_bits(magnitude);
+
+            out.write_bit(coeff < 0);
+            out.write_n_bits(bits_needed, 5);
+            out.write_n_bits(magnitude, bits_needed);
+        }
     }
 }
 
+double scale_of(int step) { return exp2(static_cast<double>(step) / SCALE_STEPS); }
+
+// Cost curve of a block for rate control, built with the analysis so that
+// it runs in parallel: the bits the block takes at each scale step,
+// counting its entry in the size table and its padding to a byte
+// boundary, from the coarsest step to finer ones. Magnitudes only grow as
+// the step gets finer, so the curve never decreases and stops at the first
+// step that costs more than `max_budget` (no block can afford it) or at
+// which a magnitude would not fit MAX_MAGNITUDE_BITS (with a base below the
+// default, the finest steps overflow). The coarsest step is always there.
+void cost_steps(AnalyzedBlock &block, const DctTables &long_tables,
+                const DctTables &short_tables, double max_budget) {
+    const DctTables &tables = block.transient ? short_tables : long_tables;
+    block.step_bits.clear();
+    block.finest_reached = true;
+
+    for (int step = MAX_SCALE_STEP; step >= MIN_SCALE_STEP; step--) {
+        bool saturated = false;
+        size_t bits = 1; // type bit
+        for (size_t t = 0; t < block.energy_factors.size(); t++) {
+            uint16_t energy_enc = energy_word(block.energy_factors[t], scale_of(step));
+            bits += 16 + coefficient_bits(&block.coeffs[t * tables.size], tables,
+                                          energy_enc / 1000.0, saturated);
+        }
+        bits = (bits + 7) / 8 * 8 + 32;
+
+        if (step < MAX_SCALE_STEP && (saturated || bits > max_budget)) {
+            block.finest_reached = saturated;
+            break;
+        }
+        block.step_bits.push_back(static_cast<uint32_t>(bits));
+    }
+}
+
+// Picks the scale of each block, in order, for an average of target_bits per
+// block (size table entry included). Sequential because of the bit
+// reservoir: a block may spend half of what the blocks before it saved (at
+// most RESERVOIR_BLOCKS average blocks) and pays back half of what they
+// overspent. Each block's scale is the finest one within its budget, looked
+// up in its cost curve, so this is only bookkeeping. Only past blocks
+// matter, so the blocks can be fed a batch at a time.
+class RateController {
+  public:
+    RateController(double target_bits)
+        : m_target_bits(target_bits), m_capacity(RESERVOIR_BLOCKS * target_bits) {}
+
+    // Largest budget a block can get: the cost curves need go no further
+    double max_budget() const { return m_target_bits + m_capacity / 2; }
+
+    double next_scale(const AnalyzedBlock &block) {
+        const vector<uint32_t> &bits = block.step_bits;
+        double budget = m_target_bits + m_reservoir / 2;
+
+        // Finest step within budget, or the coarsest one if none is
+        size_t j = upper_bound(bits.begin(), bits.end(), budget) - bits.begin();
+        j = max<size_t>(j, 1) - 1;
+        double cost = bits[j];
+
+        m_coarsest_bits += bits[0];
+        if (cost > budget)
+            m_over_blocks++;
+        else if (j + 1 == bits.size() && block.finest_reached)
+            m_under_blocks++;
+
+        double reservoir = m_reservoir + m_target_bits - cost;
+        m_capped_bits += max(0.0, reservoir - m_capacity);
+        m_reservoir = min(m_capacity, reservoir);
+        return scale_of(MAX_SCALE_STEP - static_cast<int>(j));
+    }
+
+    // Explains an achieved bitrate more than 2% off target. Above it:
+    // blocks over budget even at the coarsest step, whose debt no later
+    // block could pay back, with what savings the reservoir cap dropped
+    // before them. Below it: blocks under budget at the finest step that fits.
+    void report(double target_kbps, double achieved_kbps, double seconds) const {
+        auto kbps = [&](double bits) { return bits / seconds / 1000; };
+        if (achieved_kbps > target_kbps * 1.02 && m_over_blocks > 0) {
+            cerr << "Warning: " << m_over_blocks << " block(s) went over "
+                 << "budget at the coarsest quantization, which takes "
+                 << kbps(m_coarsest_bits) << " kbps over the whole input";
+            if (m_capped_bits > 0)
+                cerr << "; " << kbps(m_capped_bits)
+                     << " kbps saved by other blocks was dropped at the "
+                        "reservoir cap";
+            cerr << "\n";
+        } else if (achieved_kbps < target_kbps * 0.98 && m_under_blocks > 0) {
+            cerr << "Notice: target above what the finest quantization spends "
+                    "(" << m_under_blocks << " block(s) stayed under budget at "
+                    "their finest step)\n";
+        }
+    }
+
+  private:
+    double m_target_bits;
+    double m_capacity;
+    double m_reservoir = 0.0;
+    size_t m_over_blocks = 0;     // over budget at the coarsest step
+    size_t m_under_blocks = 0;    // under budget at the finest step
+    double m_coarsest_bits = 0.0; // all blocks at the coarsest step
+    double m_capped_bits = 0.0;   // savings dropped at the reservoir cap
+};
+
 int main(int argc, char *argv[]) {
     if (argc < 3) {
-        cerr << "Usage: " << argv[0] << " input.wav output.dct\n";
+        cerr << "Usage: " << argv[0]
+             << " input.wav output.dct [-t threads] [-q base_quantization]"
+                " [-b kbps]\n";
         return 1;
     }
 
+    unsigned threads = default_threads();
+    double base_quantization = BASE_QUANTIZATION;
+    double target_kbps = 0.0; // 0 = fixed quantization
+    for (int i = 3; i < argc; i++) {
+        if (string(argv[i]) == "-t" && i + 1 < argc) {
+            threads = max(1, atoi(argv[++i]));
+        } else if (string(argv[i]) == "-q" && i + 1 < argc) {
+            base_quantization = atof(argv[++i]);
+            if (!(base_quantization >= MIN_BASE_QUANTIZATION &&
+                  base_quantization <= 4000.0)) {
+                cerr << "Error: base quantization must be in ["
+                     << MIN_BASE_QUANTIZATION << ", 4000]\n";
+                return 1;
+            }
+        } else if (string(argv[i]) == "-b" && i + 1 < argc) {
+            target_kbps = atof(argv[++i]);
+            if (!(target_kbps > 0.0)) {
+                cerr << "Error: the target bitrate must be positive\n";
+                return 1;
+            }
+        } else {
+            cerr << "Unknown option: " << argv[i] << "\n";
+            return 1;
+        }
+    }
+
     SF_INFO sfinfo;
     SNDFILE *infile = sf_open(argv[1], SFM_READ, &sfinfo);
     if (!infile) {
@@ -94,80 +434,139 @@ int main(int argc, char *argv[]) {
         return 1;
     }
 
+    // The decoder only sees the stored micro-units, so the encoder uses them too
+    uint32_t quant_fixed = static_cast<uint32_t>(lround(base_quantization * 1000000));
+    base_quantization = quant_fixed / 1000000.0;
+
+    DctTables long_tables = make_tables(BLOCK_SIZE, base_quantization);
+    DctTables short_tables = make_tables(SHORT_BLOCK_SIZE, base_quantization);
+
+    size_t num_blocks = (sfinfo.frames + BLOCK_SIZE - 1) / BLOCK_SIZE;
+
     BitStream obs(ofs, STREAM_WRITE);
 
+    obs.write_n_bits(DCT3_MAGIC, 32);
     obs.write_n_bits(sfinfo.samplerate, 32);
     obs.write_n_bits(sfinfo.frames, 32);
     obs.write_n_bits(BLOCK_SIZE, 16);
-
-    uint32_t quant_fixed = static_cast<uint32_t>(BASE_QUANTIZATION * 1000000);
+    obs.write_n_bits(SHORT_BLOCK_SIZE, 16);
     obs.write_n_bits(quant_fixed, 32);
 
-    vector<double> buffer(BLOCK_SIZE);
-    vector<double> dct_coeffs;
-    vector<int32_t> quantized;
-
-    long long total_frames = sfinfo.frames;
-    long long frames_read = 0;
-    int blocks_processed = 0;
-
-    while (frames_read < total_frames) {
-        sf_count_t count = sf_read_double(infile, buffer.data(), BLOCK_SIZE);
+    // Block size table: lets the decoder find every block without parsing
+    // the ones before it. Written as zeros here and filled in at the end,
+    // once the sizes are known.
+    obs.write_n_bits(num_blocks, 32);
+    obs.align(); // flushes the last header byte before the raw data
+    off_t table_start = obs.tell();
+    vector<uint8_t> zeros(4 * 1024, 0);
+    for (size_t left = 4 * num_blocks; left > 0;) {
+        size_t n = min(left, zeros.size());
+        obs.write_bytes(zeros.data(), n);
+        left -= n;
+    }
 
-        if (count < BLOCK_SIZE) {
-            for (sf_count_t i = count; i < BLOCK_SIZE; i++) {
-                buffer[i] = 0.0;
-            }
+    // Blocks are read, analyzed and coded a batch at a time, so memory does
+    // not grow with the length of the input. The samples before the batch
+    // that the transient detector looks at are carried over.
+    const size_t batch_blocks = threads * 4;
+    const size_t history_samples = TRANSIENT_HISTORY * SHORT_BLOCK_SIZE;
+
+    vector<uint32_t> block_sizes;
+    block_sizes.reserve(num_blocks);
+    vector<double> input(batch_blocks * BLOCK_SIZE);
+    vector<float> samples(history_samples + batch_blocks * BLOCK_SIZE, 0.0f);
+    vector<AnalyzedBlock> analyzed(batch_blocks);
+    vector<double> scales(batch_blocks, 1.0);
+    vector<vector<uint8_t>> blocks(batch_blocks);
+    // The target covers the input's duration, not the padding of its last
+    // block, and the header before the size table is taken off it
+    double seconds = double(sfinfo.frames) / sfinfo.samplerate;
+    optional<RateController> rate;
+    if (target_kbps > 0)
+        rate.emplace(max(0.0, target_kbps * 1000 * seconds - table_start * 8.0) /
+                     max<size_t>(1, num_blocks));
+    atomic<size_t> short_blocks{0};
+    ThreadPool pool(threads);
+
+    for (size_t first = 0; first < num_blocks; first += batch_blocks) {
+        size_t count = min(batch_blocks, num_blocks - first);
+        sf_count_t frames =
+            min<sf_count_t>(count * BLOCK_SIZE, sfinfo.frames - first * BLOCK_SIZE);
+        sf_count_t frames_read = sf_read_double(infile, input.data(), frames);
+        if (frames_read != frames) {
+            cerr << "Error: read " << first * BLOCK_SIZE + frames_read << " of "
+                 << sfinfo.frames << " frames\n";
+            sf_close(infile);
+            return 1;
         }
 
-        double energy = calculate_energy(buffer);
-        double energy_factor = max(0.5, min(2.0, energy * 10.0));
-
-        dct(buffer, dct_coeffs);
-
-        quantize_weighted(dct_coeffs, quantized, BASE_QUANTIZATION,
-                          energy_factor);
-
-        uint16_t energy_enc = static_cast<uint16_t>(energy_factor * 1000);
-        obs.write_n_bits(energy_enc, 16);
-
-        for (int32_t coeff : quantized) {
-            if (coeff < 0) {
-                obs.write_bit(1);
-                coeff = -coeff;
-            } else {
-                obs.write_bit(0);
-            }
-
-            int bits_needed = 0;
-            int32_t temp = coeff;
-            while (temp > 0) {
-                bits_needed++;
-                temp >>= 1;
-            }
-
-            if (bits_needed == 0)
-                bits_needed = 1;
-            if (bits_needed > 20)
-                bits_needed = 20;
+        // The transform and quantization run in single precision; the last
+        // block is zero padded
+        copy(samples.end() - history_samples, samples.end(), samples.begin());
+        fill(copy(input.begin(), input.begin() + frames,
+                  samples.begin() + history_samples),
+             samples.end(), 0.0f);
+
+        pool.parallel_for(count, [&](size_t i) {
+            analyzed[i] = analyze_block(&samples[history_samples + i * BLOCK_SIZE],
+                                        min((first + i) * BLOCK_SIZE,
+                                            history_samples + i * BLOCK_SIZE),
+                                        long_tables, short_tables);
+            if (analyzed[i].transient)
+                short_blocks++;
+            if (rate)
+                cost_steps(analyzed[i], long_tables, short_tables,
+                           rate->max_budget());
+        });
+
+        if (rate) {
+            for (size_t i = 0; i < count; i++)
+                scales[i] = rate->next_scale(analyzed[i]);
+        }
 
-            obs.write_n_bits(bits_needed, 5);
+        pool.parallel_for(count, [&](size_t i) {
+            BlockBitWriter writer;
+            code_block(analyzed[i], long_tables, short_tables, scales[i], writer);
+            blocks[i] = writer.flush();
+        });
 
-            obs.write_n_bits(coeff, bits_needed);
+        for (size_t i = 0; i < count; i++) {
+            obs.write_bytes(blocks[i].data(), blocks[i].size());
+            block_sizes.push_back(blocks[i].size());
         }
+    }
 
-        frames_read += count;
-        blocks_processed++;
+    sf_close(infile);
+    obs.close();
 
-        if (count < BLOCK_SIZE)
-            break;
+    // Fill in the size table
+    fstream table_fs(argv[2], ios::in | ios::out | ios::binary);
+    vector<uint8_t> table(4 * num_blocks);
+    for (size_t b = 0; b < num_blocks; b++) {
+        uint32_t size = block_sizes[b];
+        table[4 * b] = size >> 24;
+        table[4 * b + 1] = size >> 16;
+        table[4 * b + 2] = size >> 8;
+        table[4 * b + 3] = size;
     }
+    table_fs.seekp(table_start);
+    table_fs.write(reinterpret_cast<const char *>(table.data()), table.size());
+    if (!table_fs) {
+        cerr << "Error writing the block size table\n";
+        return 1;
+    }
+    table_fs.close();
 
-    obs.close();
-    sf_close(infile);
+    if (target_kbps > 0) {
+        double achieved = filesystem::file_size(argv[2]) * 8 / seconds / 1000;
+        cout << "Target bitrate: " << target_kbps << " kbps, achieved "
+             << achieved << " kbps\n";
+        rate->report(target_kbps, achieved, seconds);
+    }
 
     cout << "Encoding complete.\n";
-    cout << "Processed " << blocks_processed << " blocks\n";
+    cout << "Processed " << num_blocks << " blocks on " << threads
+         << " thread(s), " << short_blocks << " with short transforms\n";
     cout << "Using adaptive quantization and psychoacoustic weighting.\n";
 
     return 0;
@@ -1,39 +1,124 @@
 #include <opencv2/opencv.hpp>
+#include <opencv2/core/hal/intrin.hpp>
 #include <iostream>
 #include <string>
 
 cv::Mat extractChannel(const cv::Mat& src, int channel) {
+    CV_Assert(src.type() == CV_8UC3 && channel >= 0 && channel <= 2);
+
     // Create output image (single channel, grayscale)
     cv::Mat result(src.rows, src.cols, CV_8UC1);
 
-    // Process pixel by pixel
-    for (int row = 0; row < src.rows; ++row) {
-        for (int col = 0; col < src.cols; ++col) {
-            // Read BGR pixel
-            cv::Vec3b pixel = src.at<cv::Vec3b>(row, col);
+    // Row pointers instead of at<>(): one strided walk over each source row
+    cv::parallel_for_(cv::Range(0, src.rows), [&](const cv::Range& range) {
+        for (int row = range.start; row < range.end; ++row) {
+            const uchar* in = src.ptr<uchar>(row);
+            uchar* out = result.ptr<uchar>(row);
+            int col = 0;
+#if CV_SIMD128
+            // 16 pixels at a time: deinterleave 48 bytes into B, G and R lanes
+            for (; col + 16 <= src.cols; col += 16) {
+                cv::v_uint8x16 b, g, r;
+                cv::v_load_deinterleave(in + 3 * col, b, g, r);
+                cv::v_store(out + col, channel == 0 ? b : (channel == 1 ? g : r));
+            }
+#endif
+            for (; col < src.cols; ++col) {
+                out[col] = in[3 * col + channel];
+            }
+        }
+    });
 
-            // Extract the specified channel and write to result
-            result.at<uchar>(row, col) = pixel[channel];
+    return result;
+}
+
+// Splits a BGR image into its B, G and R planes, reading the source only once
+void splitChannels(const cv::Mat& src, cv::Mat planes[3]) {
+    CV_Assert(src.type() == CV_8UC3);
+
+    for (int ch = 0; ch < 3; ++ch) {
+        planes[ch].create(src.rows, src.cols, CV_8UC1);
+    }
+
+    cv::parallel_for_(cv::Range(0, src.rows), [&](const cv::Range& range) {
+        for (int row = range.start; row < range.end; ++row) {
+            const uchar* in = src.ptr<uchar>(row);
+            uchar* outB = planes[0].ptr<uchar>(row);
+            uchar* outG = planes[1].ptr<uchar>(row);
+            uchar* outR = planes[2].ptr<uchar>(row);
+            int col = 0;
+#if CV_SIMD128
+            for (; col + 16 <= src.cols; col += 16) {
+                cv::v_uint8x16 b, g, r;
+                cv::v_load_deinterleave(in + 3 * col, b, g, r);
+                cv::v_store(outB + col, b);
+                cv::v_store(outG + col, g);
+                cv::v_store(outR + col, r);
+            }
+#endif
+            for (; col < src.cols; ++col) {
+                outB[col] = in[3 * col];
+                outG[col] = in[3 * col + 1];
+                outR[col] = in[3 * col + 2];
+            }
         }
+    });
+}
+
+// Writes a single-channel plane; PPM outputs get the value replicated in BGR
+bool writePlane(const std::string& outputFile, const cv::Mat& plane) {
+    cv::Mat outputImage;
+    std::string extension = outputFile.substr(outputFile.find_last_of(".") + 1);
+
+    if (extension == "ppm" || extension == "PPM") {
+        // PPM format requires 3-channel BGR image
+        // Convert single channel to 3-channel by replicating the grayscale values
+        cv::cvtColor(plane, outputImage, cv::COLOR_GRAY2BGR);
+    } else {
+        // For other formats (jpg, png, pgm, etc.), use the single channel image
+        outputImage = plane;
     }
 
-    return result;
+    // Write the output image (format determined by file extension)
+    if (!cv::imwrite(outputFile, outputImage)) {
+        std::cerr << "Error: Could not write image to " << outputFile << std::endl;
+        return false;
+    }
+    return true;
+}
+
+void printUsage(const char* prog) {
+    std::cout << "Usage: " << prog << " <input_image> <output_image> <channel>" << std::endl;
+    std::cout << "       " << prog << " -split <input_image> <output_blue> <output_green> <output_red>" << std::endl;
+    std::cout << "  channel: 0=Blue, 1=Green, 2=Red" << std::endl;
+    std::cout << "  -split : write all three planes in a single pass over the input" << std::endl;
+    std::cout << "Supported formats: JPG, PNG, BMP, PPM, PGM, etc." << std::endl;
+    std::cout << "Example: " << prog << " input.ppm output.ppm 2" << std::endl;
+    std::cout << "Example: " << prog << " input.jpg output.jpg 1" << std::endl;
+    std::cout << "Example: " << prog << " -split input.ppm b.pgm g.pgm r.pgm" << std::endl;
 }
 
 int main(int argc, char** argv) {
+    const bool splitMode = (argc >= 2 && std::string(argv[1]) == "-split");
+
     // Check command line arguments
-    if (argc != 4) {
-        std::cout << "Usage: " << argv[0] << " <input_image> <output_image> <channel>" << std::endl;
-        std::cout << "  channel: 0=Blue, 1=Green, 2=Red" << std::endl;
-        std::cout << "Supported formats: JPG, PNG, BMP, PPM, PGM, etc." << std::endl;
-        std::cout << "Example: " << argv[0] << " input.ppm output.ppm 2" << std::endl;
-        std::cout << "Example: " << argv[0] << " input.jpg output.jpg 1" << std::endl;
+    if ((splitMode && argc != 6) || (!splitMode && argc != 4)) {
+        printUsage(argv[0]);
         return -1;
     }
 
-    std::string inputFile = argv[1];
-    std::string outputFile = argv[2];
-    int channel = std::stoi(argv[3]);
+    std::string inputFile = splitMode ? argv[2] : argv[1];
+
+    int channel = 0;
+    if (!splitMode) {
+        channel = std::stoi(argv[3]);
+
+        // Validate channel number (0=Blue, 1=Green, 2=Red)
+        if (channel < 0 || channel > 2) {
+            std::cerr << "Error: Invalid channel number. Must be 0 (Blue), 1 (Green), or 2 (Red)" << std::endl;
+            return -1;
+        }
+    }
 
     // Read the input image (supports PPM, JPG, PNG, BMP, etc.)
     cv::Mat src = cv::imread(inputFile, cv::IMREAD_COLOR);
@@ -44,31 +129,28 @@ int main(int argc, char** argv) {
         return -1;
     }
 
-    // Validate channel number (0=Blue, 1=Green, 2=Red)
-    if (channel < 0 || channel > 2) {
-        std::cerr << "Error: Invalid channel number. Must be 0 (Blue), 1 (Green), or 2 (Red)" << std::endl;
-        return -1;
-    }
+    if (splitMode) {
+        cv::Mat planes[3];
+        splitChannels(src, planes);
 
-    // Extract channel pixel by pixel
-    cv::Mat result = extractChannel(src, channel);
+        const char* names[3] = {"Blue", "Green", "Red"};
+        for (int ch = 0; ch < 3; ++ch) {
+            if (!writePlane(argv[3 + ch], planes[ch])) {
+                return -1;
+            }
+            std::cout << names[ch] << " plane -> " << argv[3 + ch] << std::endl;
+        }
+        std::cout << "Successfully split " << inputFile << std::endl;
+        std::cout << "Image size: " << src.rows << "x" << src.cols << std::endl;
+        return 0;
+    }
 
-    // Check if output format is PPM - if so, convert grayscale to BGR
-    cv::Mat outputImage;
-    std::string extension = outputFile.substr(outputFile.find_last_of(".") + 1);
+    std::string outputFile = argv[2];
 
-    if (extension == "ppm" || extension == "PPM") {
-        // PPM format requires 3-channel BGR image
-        // Convert single channel to 3-channel by replicating the grayscale values
-        cv::cvtColor(result, outputImage, cv::COLOR_GRAY2BGR);
-    } else {
-        // For other formats (jpg, png, pgm, etc.), use the single channel image
-        outputImage = result;
-    }
+    // Extract the requested channel
+    cv::Mat result = extractChannel(src, channel);
 
-    // Write the output image (format determined by file extension)
-    if (!cv::imwrite(outputFile, outputImage)) {
-        std::cerr << "Error: Could not write image to " << outputFile << std::endl;
+    if (!writePlane(outputFile, result)) {
         return -1;
     }
 
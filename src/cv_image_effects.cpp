@@ -5,23 +5,90 @@
 #include "effects/mirror.hpp"
 #include "effects/rotate.hpp"
 #include "effects/brightness.hpp"
+#include "effects/pipeline.hpp"
+#include "frame_stream.hpp"
 
 void printUsage(const char* progName) {
     std::cout << "Usage: " << progName << " <input_image> <output_image> <effect> [parameters]" << std::endl;
+    std::cout << "       " << progName << " -stream <input> <output> <effect> [parameters] [<effect> [parameters] ...]" << std::endl;
     std::cout << "\nSupported formats: JPG, PNG, BMP, PPM, etc." << std::endl;
     std::cout << "\nAvailable effects:" << std::endl;
     std::cout << "  negative              - Creates negative version of image" << std::endl;
     std::cout << "  mirror <h|v>          - Mirrors image horizontally or verically" << std::endl;
     std::cout << "  rotate <n>            - Rotates image by n*90 degrees (e.g., 1=90°, 2=180°, 3=270°)" << std::endl;
     std::cout << "  brightness <delta>    - Adjusts brightness (positive=lighter, negative=darker)" << std::endl;
+    std::cout << "  pipeline <effects...> - Applies a chain of the effects above in a single pass" << std::endl;
+    std::cout << "\nStreaming mode (-stream) applies the chain to every frame of:" << std::endl;
+    std::cout << "  a directory of images, an image sequence (frames/%04d.png) or a video file," << std::endl;
+    std::cout << "  writing a directory, an image sequence or a video file." << std::endl;
     std::cout << "\nExamples:" << std::endl;
     std::cout << "  " << progName << " input.ppm output.ppm negative" << std::endl;
     std::cout << "  " << progName << " input.jpg output.jpg mirror-h" << std::endl;
     std::cout << "  " << progName << " input.jpg output.jpg rotate 2" << std::endl;
     std::cout << "  " << progName << " input.ppm output.ppm brightness 50" << std::endl;
+    std::cout << "  " << progName << " input.ppm output.ppm pipeline negative mirror h brightness 50" << std::endl;
+    std::cout << "  " << progName << " -stream input.mp4 output.mp4 rotate 2 brightness 20" << std::endl;
+    std::cout << "  " << progName << " -stream scans/ scans_out/ negative" << std::endl;
+}
+
+// Parses a list of effects (same syntax as the single-effect mode) into a pipeline
+bool parsePipeline(int argc, char** argv, int first, EffectPipeline& pipeline) {
+    for (int i = first; i < argc; ++i) {
+        std::string name = argv[i];
+
+        if (name == "negative") {
+            pipeline.addNegative();
+            continue;
+        }
+
+        if (name != "mirror" && name != "rotate" && name != "brightness") {
+            std::cerr << "Error: Unknown effect '" << name << "' in pipeline" << std::endl;
+            return false;
+        }
+        if (i + 1 >= argc) {
+            std::cerr << "Error: " << name << " effect requires a parameter" << std::endl;
+            return false;
+        }
+        std::string param = argv[++i];
+
+        if (name == "mirror") {
+            if (param == "h") {
+                pipeline.addMirrorHorizontal();
+            } else if (param == "v") {
+                pipeline.addMirrorVertical();
+            } else {
+                std::cerr << "Error: Invalid mirror direction '" << param << "'. Use 'h' or 'v'." << std::endl;
+                return false;
+            }
+        } else if (name == "rotate") {
+            pipeline.addRotate(std::stoi(param));
+        } else {
+            pipeline.addBrightness(std::stoi(param));
+        }
+    }
+
+    if (pipeline.empty()) {
+        std::cerr << "Error: pipeline requires at least one effect" << std::endl;
+        return false;
+    }
+    return true;
 }
 
 int main(int argc, char** argv) {
+    // Streaming mode: every frame of a directory, image sequence or video
+    if (argc >= 2 && std::string(argv[1]) == "-stream") {
+        EffectPipeline pipeline;
+        if (argc < 5 || !parsePipeline(argc, argv, 4, pipeline)) {
+            std::cout << "Usage: " << argv[0] << " -stream <input> <output> <effect> [param] <effect> [param] ..." << std::endl;
+            return -1;
+        }
+        if (!processFrameStream(argv[2], argv[3], pipeline)) {
+            return -1;
+        }
+        std::cout << "Successfully processed " << argv[2] << " -> " << argv[3] << std::endl;
+        return 0;
+    }
+
     // Check minimum arguments
     if (argc < 4) {
         printUsage(argv[0]);
@@ -87,6 +154,15 @@ int main(int argc, char** argv) {
         result = adjustBrightness(src, delta);
         std::cout << "Applied brightness adjustment: " << (delta > 0 ? "+" : "") << delta << std::endl;
     }
+    else if (effect == "pipeline") {
+        EffectPipeline pipeline;
+        if (!parsePipeline(argc, argv, 4, pipeline)) {
+            std::cout << "Usage: " << argv[0] << " <input> <output> pipeline <effect> [param] <effect> [param] ..." << std::endl;
+            return -1;
+        }
+        result = pipeline.apply(src);
+        std::cout << "Applied pipeline of " << pipeline.size() << " effects in a single pass" << std::endl;
+    }
     else {
         std::cerr << "Error: Unknown effect '" << effect << "'" << std::endl;
         printUsage(argv[0]);
@@ -1,31 +1,54 @@
 #include "effects/brightness.hpp"
 #include <algorithm>
+#include <cstddef>
+#include <cstdlib>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
-cv::Mat adjustBrightness(const cv::Mat& src, int delta) {
-    cv::Mat result(src.rows, src.cols, src.type());
-
-    // For color images
-    if (src.channels() == 3) {
-        for (int row = 0; row < src.rows; ++row) {
-            for (int col = 0; col < src.cols; ++col) {
-                cv::Vec3b pixel = src.at<cv::Vec3b>(row, col);
-                result.at<cv::Vec3b>(row, col) = cv::Vec3b(
-                    std::clamp(pixel[0] + delta, 0, 255),  // Blue
-                    std::clamp(pixel[1] + delta, 0, 255),  // Green
-                    std::clamp(pixel[2] + delta, 0, 255)   // Red
-                );
-            }
+// Adds delta to n bytes with saturation to [0, 255]
+static void addSaturatedBytes(const uchar* src, uchar* dst, size_t n, int delta) {
+    size_t i = 0;
+#ifdef __SSE2__
+    // Saturating unsigned add/sub clamp exactly like std::clamp(v + delta, 0, 255)
+    const __m128i amount = _mm_set1_epi8(static_cast<char>(std::min(std::abs(delta), 255)));
+    if (delta >= 0) {
+        for (; i + 16 <= n; i += 16) {
+            __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_adds_epu8(v, amount));
         }
-    }
-    // For grayscale images
-    else if (src.channels() == 1) {
-        for (int row = 0; row < src.rows; ++row) {
-            for (int col = 0; col < src.cols; ++col) {
-                int value = src.at<uchar>(row, col) + delta;
-                result.at<uchar>(row, col) = std::clamp(value, 0, 255);
-            }
+    } else {
+        for (; i + 16 <= n; i += 16) {
+            __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_subs_epu8(v, amount));
         }
     }
+#endif
+    for (; i < n; ++i) {
+        dst[i] = static_cast<uchar>(std::clamp(src[i] + delta, 0, 255));
+    }
+}
 
+cv::Mat adjustBrightness(const cv::Mat& src, int delta) {
+    cv::Mat result;
+    adjustBrightness(src, result, delta);
     return result;
 }
+
+void adjustBrightness(const cv::Mat& src, cv::Mat& dst, int delta) {
+    CV_Assert(src.depth() == CV_8U);
+    dst.create(src.rows, src.cols, src.type());
+
+    // Same clamp for every channel, so rows are processed as flat byte runs
+    // (element-wise, so dst may alias src)
+    const size_t rowBytes = static_cast<size_t>(src.cols) * src.elemSize();
+    cv::parallel_for_(cv::Range(0, src.rows), [&](const cv::Range& range) {
+        for (int row = range.start; row < range.end; ++row) {
+            addSaturatedBytes(src.ptr<uchar>(row), dst.ptr<uchar>(row), rowBytes, delta);
+        }
+    });
+}
+
+void adjustBrightnessInPlace(cv::Mat& img, int delta) {
+    adjustBrightness(img, img, delta);
+}
@@ -1,47 +1,93 @@
 #include "effects/mirror.hpp"
+#include <algorithm>
+#include <cstring>
 
-cv::Mat mirrorHorizontal(const cv::Mat& src) {
-    cv::Mat result(src.rows, src.cols, src.type());
+namespace {
 
-    // For color images
-    if (src.channels() == 3) {
-        for (int row = 0; row < src.rows; ++row) {
-            for (int col = 0; col < src.cols; ++col) {
-                result.at<cv::Vec3b>(row, col) = src.at<cv::Vec3b>(row, src.cols - 1 - col);
-            }
-        }
+template <typename T>
+void reverseRows(const cv::Mat& src, cv::Mat& dst) {
+    for (int row = 0; row < src.rows; ++row) {
+        const T* in = src.ptr<T>(row);
+        std::reverse_copy(in, in + src.cols, dst.ptr<T>(row));
     }
-    // For grayscale images
-    else if (src.channels() == 1) {
-        for (int row = 0; row < src.rows; ++row) {
-            for (int col = 0; col < src.cols; ++col) {
-                result.at<uchar>(row, col) = src.at<uchar>(row, src.cols - 1 - col);
-            }
-        }
+}
+
+template <typename T>
+void reverseRowsInPlace(cv::Mat& img) {
+    for (int row = 0; row < img.rows; ++row) {
+        T* p = img.ptr<T>(row);
+        std::reverse(p, p + img.cols);
     }
+}
+
+} // namespace
 
+cv::Mat mirrorHorizontal(const cv::Mat& src) {
+    cv::Mat result;
+    mirrorHorizontal(src, result);
     return result;
 }
 
 cv::Mat mirrorVertical(const cv::Mat& src) {
-    cv::Mat result(src.rows, src.cols, src.type());
+    cv::Mat result;
+    mirrorVertical(src, result);
+    return result;
+}
+
+void mirrorHorizontal(const cv::Mat& src, cv::Mat& dst) {
+    CV_Assert(src.depth() == CV_8U && (src.channels() == 1 || src.channels() == 3));
+
+    if (dst.data == src.data) {
+        dst = src;
+        mirrorHorizontalInPlace(dst);
+        return;
+    }
+
+    dst.create(src.rows, src.cols, src.type());
 
     // For color images
     if (src.channels() == 3) {
-        for (int row = 0; row < src.rows; ++row) {
-            for (int col = 0; col < src.cols; ++col) {
-                result.at<cv::Vec3b>(row, col) = src.at<cv::Vec3b>(src.rows - 1 - row, col);
-            }
-        }
+        reverseRows<cv::Vec3b>(src, dst);
     }
     // For grayscale images
-    else if (src.channels() == 1) {
-        for (int row = 0; row < src.rows; ++row) {
-            for (int col = 0; col < src.cols; ++col) {
-                result.at<uchar>(row, col) = src.at<uchar>(src.rows - 1 - row, col);
-            }
-        }
+    else {
+        reverseRows<uchar>(src, dst);
     }
+}
 
-    return result;
+void mirrorVertical(const cv::Mat& src, cv::Mat& dst) {
+    CV_Assert(src.depth() == CV_8U);
+
+    if (dst.data == src.data) {
+        dst = src;
+        mirrorVerticalInPlace(dst);
+        return;
+    }
+
+    dst.create(src.rows, src.cols, src.type());
+
+    // Whole rows move unchanged, whatever the number of channels
+    const size_t rowBytes = static_cast<size_t>(src.cols) * src.elemSize();
+    for (int row = 0; row < src.rows; ++row) {
+        std::memcpy(dst.ptr<uchar>(row), src.ptr<uchar>(src.rows - 1 - row), rowBytes);
+    }
+}
+
+void mirrorHorizontalInPlace(cv::Mat& img) {
+    CV_Assert(img.depth() == CV_8U && (img.channels() == 1 || img.channels() == 3));
+
+    if (img.channels() == 3) {
+        reverseRowsInPlace<cv::Vec3b>(img);
+    } else {
+        reverseRowsInPlace<uchar>(img);
+    }
+}
+
+void mirrorVerticalInPlace(cv::Mat& img) {
+    CV_Assert(img.depth() == CV_8U);
+
+    const size_t rowBytes = static_cast<size_t>(img.cols) * img.elemSize();
+    for (int top = 0, bottom = img.rows - 1; top < bottom; ++top, --bottom) {
+        std::swap_ranges(img.ptr<uchar>(top), img.ptr<uchar>(top) + rowBytes, img.ptr<uchar>(bottom));
+    }
 }
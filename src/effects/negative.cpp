@@ -1,29 +1,45 @@
 #include "effects/negative.hpp"
+#include <cstddef>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
-cv::Mat createNegative(const cv::Mat& src) {
-    cv::Mat result(src.rows, src.cols, src.type());
-
-    // For color images
-    if (src.channels() == 3) {
-        for (int row = 0; row < src.rows; ++row) {
-            for (int col = 0; col < src.cols; ++col) {
-                cv::Vec3b pixel = src.at<cv::Vec3b>(row, col);
-                result.at<cv::Vec3b>(row, col) = cv::Vec3b(
-                    255 - pixel[0],  // Blue
-                    255 - pixel[1],  // Green
-                    255 - pixel[2]   // Red
-                );
-            }
-        }
+// Inverts n bytes: for 8-bit values 255 - v is the same as v ^ 0xFF
+static void negateBytes(const uchar* src, uchar* dst, size_t n) {
+    size_t i = 0;
+#ifdef __SSE2__
+    const __m128i allOnes = _mm_set1_epi8(static_cast<char>(0xFF));
+    for (; i + 16 <= n; i += 16) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_xor_si128(v, allOnes));
     }
-    // For grayscale images
-    else if (src.channels() == 1) {
-        for (int row = 0; row < src.rows; ++row) {
-            for (int col = 0; col < src.cols; ++col) {
-                result.at<uchar>(row, col) = 255 - src.at<uchar>(row, col);
-            }
-        }
+#endif
+    for (; i < n; ++i) {
+        dst[i] = static_cast<uchar>(src[i] ^ 0xFF);
     }
+}
 
+cv::Mat createNegative(const cv::Mat& src) {
+    cv::Mat result;
+    createNegative(src, result);
     return result;
 }
+
+void createNegative(const cv::Mat& src, cv::Mat& dst) {
+    CV_Assert(src.depth() == CV_8U);
+    dst.create(src.rows, src.cols, src.type());
+
+    // A point operation does not care about channels: every row (grayscale or
+    // BGR) is processed as one flat run of bytes, rows split across threads.
+    // Each byte is read before it is written, so dst may alias src.
+    const size_t rowBytes = static_cast<size_t>(src.cols) * src.elemSize();
+    cv::parallel_for_(cv::Range(0, src.rows), [&](const cv::Range& range) {
+        for (int row = range.start; row < range.end; ++row) {
+            negateBytes(src.ptr<uchar>(row), dst.ptr<uchar>(row), rowBytes);
+        }
+    });
+}
+
+void createNegativeInPlace(cv::Mat& img) {
+    createNegative(img, img);
+}
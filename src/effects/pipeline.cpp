@@ -0,0 +1,180 @@
+#include "effects/pipeline.hpp"
+#include <algorithm>
+#include <array>
+#include <cstddef>
+
+namespace {
+
+// Maps a destination pixel (r, c) to its source pixel:
+//   srcRow = m[0][0]*r + m[0][1]*c + t[0]
+//   srcCol = m[1][0]*r + m[1][1]*c + t[1]
+// Every mirror/rotate is such an affine map, so any chain of them is one too.
+struct CoordMap {
+    int m[2][2] = {{1, 0}, {0, 1}};
+    int t[2] = {0, 0};
+    int rows = 0;   // destination size after all steps so far
+    int cols = 0;
+
+    // Appends a step whose own destination->source map is g*(r, c) + g0
+    void compose(const int g[2][2], const int g0[2], int newRows, int newCols) {
+        int nm[2][2];
+        int nt[2];
+        for (int i = 0; i < 2; ++i) {
+            for (int j = 0; j < 2; ++j) {
+                nm[i][j] = m[i][0] * g[0][j] + m[i][1] * g[1][j];
+            }
+            nt[i] = m[i][0] * g0[0] + m[i][1] * g0[1] + t[i];
+        }
+        std::copy(&nm[0][0], &nm[0][0] + 4, &m[0][0]);
+        std::copy(nt, nt + 2, t);
+        rows = newRows;
+        cols = newCols;
+    }
+
+    void mirrorHorizontal() {
+        const int g[2][2] = {{1, 0}, {0, -1}};
+        const int g0[2] = {0, cols - 1};
+        compose(g, g0, rows, cols);
+    }
+
+    void mirrorVertical() {
+        const int g[2][2] = {{-1, 0}, {0, 1}};
+        const int g0[2] = {rows - 1, 0};
+        compose(g, g0, rows, cols);
+    }
+
+    // Same convention as rotate90(): dst(r, c) = src(rows - 1 - c, r)
+    void rotate90() {
+        const int g[2][2] = {{0, -1}, {1, 0}};
+        const int g0[2] = {rows - 1, 0};
+        compose(g, g0, cols, rows);
+    }
+};
+
+// Walks one destination row: p starts at the source pixel of column 0 and
+// advances by stride bytes per destination pixel
+template <int CN>
+void remapRow(const uchar* p, std::ptrdiff_t stride, uchar* out, int cols,
+              const std::array<uchar, 256>& lut) {
+    for (int col = 0; col < cols; ++col) {
+        for (int ch = 0; ch < CN; ++ch) {
+            out[ch] = lut[p[ch]];
+        }
+        out += CN;
+        p += stride;
+    }
+}
+
+void remapRowGeneric(const uchar* p, std::ptrdiff_t stride, uchar* out, int cols, int cn,
+                     const std::array<uchar, 256>& lut) {
+    for (int col = 0; col < cols; ++col) {
+        for (int ch = 0; ch < cn; ++ch) {
+            out[ch] = lut[p[ch]];
+        }
+        out += cn;
+        p += stride;
+    }
+}
+
+} // namespace
+
+void EffectPipeline::addNegative() {
+    steps.push_back({StepType::NEGATIVE, 0});
+}
+
+void EffectPipeline::addBrightness(int delta) {
+    steps.push_back({StepType::BRIGHTNESS, delta});
+}
+
+void EffectPipeline::addMirrorHorizontal() {
+    steps.push_back({StepType::MIRROR_H, 0});
+}
+
+void EffectPipeline::addMirrorVertical() {
+    steps.push_back({StepType::MIRROR_V, 0});
+}
+
+void EffectPipeline::addRotate(int rotations) {
+    steps.push_back({StepType::ROTATE, rotations});
+}
+
+cv::Mat EffectPipeline::apply(const cv::Mat& src) const {
+    cv::Mat result;
+    apply(src, result);
+    return result;
+}
+
+void EffectPipeline::apply(const cv::Mat& src, cv::Mat& dst) const {
+    CV_Assert(src.depth() == CV_8U);
+
+    // Compile the chain: point operations commute with geometric ones, so each
+    // kind is folded separately while keeping the order within the kind
+    std::array<uchar, 256> lut;
+    for (int i = 0; i < 256; ++i) {
+        lut[i] = static_cast<uchar>(i);
+    }
+
+    CoordMap map;
+    map.rows = src.rows;
+    map.cols = src.cols;
+
+    for (const Step& step : steps) {
+        switch (step.type) {
+            case StepType::NEGATIVE:
+                for (auto& v : lut) v = static_cast<uchar>(255 - v);
+                break;
+            case StepType::BRIGHTNESS:
+                for (auto& v : lut) v = static_cast<uchar>(std::clamp(v + step.param, 0, 255));
+                break;
+            case StepType::MIRROR_H:
+                map.mirrorHorizontal();
+                break;
+            case StepType::MIRROR_V:
+                map.mirrorVertical();
+                break;
+            case StepType::ROTATE: {
+                int rotations = ((step.param % 4) + 4) % 4;
+                for (int i = 0; i < rotations; ++i) {
+                    map.rotate90();
+                }
+                break;
+            }
+        }
+    }
+
+    // A chain of point operations only (or one whose moves cancel out) reads
+    // and writes each byte at the same position, which is safe in place
+    const bool identityMap = map.m[0][0] == 1 && map.m[0][1] == 0 && map.m[1][0] == 0 &&
+                             map.m[1][1] == 1 && map.t[0] == 0 && map.t[1] == 0;
+    cv::Mat result;
+    if (dst.data != src.data || identityMap) {
+        dst.create(map.rows, map.cols, src.type());
+        result = dst;
+    } else {
+        result.create(map.rows, map.cols, src.type());
+    }
+
+    // Single fused pass: geometric remap and lookup table together
+    const int cn = src.channels();
+    const std::ptrdiff_t srcStep = static_cast<std::ptrdiff_t>(src.step);
+    const std::ptrdiff_t stride = map.m[0][1] * srcStep + map.m[1][1] * cn;
+
+    for (int row = 0; row < result.rows; ++row) {
+        int srcRow = map.m[0][0] * row + map.t[0];
+        int srcCol = map.m[1][0] * row + map.t[1];
+        const uchar* p = src.ptr<uchar>(srcRow) + static_cast<std::ptrdiff_t>(srcCol) * cn;
+        uchar* out = result.ptr<uchar>(row);
+
+        if (cn == 3) {
+            remapRow<3>(p, stride, out, result.cols, lut);
+        } else if (cn == 1) {
+            remapRow<1>(p, stride, out, result.cols, lut);
+        } else {
+            remapRowGeneric(p, stride, out, result.cols, cn, lut);
+        }
+    }
+
+    if (result.data != dst.data) {
+        dst = result;
+    }
+}
@@ -1,37 +1,209 @@
 #include "effects/rotate.hpp"
+#include <algorithm>
+#include <utility>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
-cv::Mat rotate90(const cv::Mat& src) {
-    cv::Mat result(src.cols, src.rows, src.type());
+namespace {
+
+// Side of the square destination tiles, in pixels. A tile of the source and
+// one of the destination stay in L1/L2 while it is being transposed.
+const int TILE = 64;
 
-    // For color images
-    if (src.channels() == 3) {
-        for (int row = 0; row < src.rows; ++row) {
-            for (int col = 0; col < src.cols; ++col) {
-                result.at<cv::Vec3b>(col, src.rows - 1 - row) = src.at<cv::Vec3b>(row, col);
+// Copies the destination rectangle [r0, r1) x [c0, c1) pixel by pixel
+// clockwise:  dst(r, c) = src(rows - 1 - c, r)          (90 degrees)
+// otherwise:  dst(r, c) = src(c, cols - 1 - r)          (270 degrees)
+template <typename T>
+void rotatePixels(const cv::Mat& src, cv::Mat& dst, bool clockwise,
+                  int r0, int r1, int c0, int c1) {
+    for (int r = r0; r < r1; ++r) {
+        T* out = dst.ptr<T>(r);
+        if (clockwise) {
+            for (int c = c0; c < c1; ++c) {
+                out[c] = src.ptr<T>(src.rows - 1 - c)[r];
+            }
+        } else {
+            const int srcCol = src.cols - 1 - r;
+            for (int c = c0; c < c1; ++c) {
+                out[c] = src.ptr<T>(c)[srcCol];
             }
         }
     }
-    // For grayscale images
-    else if (src.channels() == 1) {
-        for (int row = 0; row < src.rows; ++row) {
-            for (int col = 0; col < src.cols; ++col) {
-                result.at<uchar>(col, src.rows - 1 - row) = src.at<uchar>(row, col);
+}
+
+#ifdef __SSE2__
+// Transposes an 8x8 byte block: out[i][j] = in[j][i]
+inline void transpose8x8(const uchar* const in[8], uchar* const out[8]) {
+    __m128i a[8];
+    for (int j = 0; j < 8; ++j) {
+        a[j] = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(in[j]));
+    }
+
+    __m128i t0 = _mm_unpacklo_epi8(a[0], a[1]);
+    __m128i t1 = _mm_unpacklo_epi8(a[2], a[3]);
+    __m128i t2 = _mm_unpacklo_epi8(a[4], a[5]);
+    __m128i t3 = _mm_unpacklo_epi8(a[6], a[7]);
+
+    __m128i u0 = _mm_unpacklo_epi16(t0, t1);
+    __m128i u1 = _mm_unpackhi_epi16(t0, t1);
+    __m128i u2 = _mm_unpacklo_epi16(t2, t3);
+    __m128i u3 = _mm_unpackhi_epi16(t2, t3);
+
+    // Each register now holds two complete output rows
+    __m128i v[4] = {
+        _mm_unpacklo_epi32(u0, u2),
+        _mm_unpackhi_epi32(u0, u2),
+        _mm_unpacklo_epi32(u1, u3),
+        _mm_unpackhi_epi32(u1, u3)
+    };
+
+    for (int i = 0; i < 4; ++i) {
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(out[2 * i]), v[i]);
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(out[2 * i + 1]), _mm_srli_si128(v[i], 8));
+    }
+}
+
+// Grayscale tile: whole 8x8 blocks go through the SSE2 transpose, the ragged
+// right/bottom edges fall back to the scalar copy
+void rotateTileGray(const cv::Mat& src, cv::Mat& dst, bool clockwise,
+                    int r0, int r1, int c0, int c1) {
+    int r = r0;
+    for (; r + 8 <= r1; r += 8) {
+        int c = c0;
+        for (; c + 8 <= c1; c += 8) {
+            const uchar* in[8];
+            uchar* out[8];
+            for (int j = 0; j < 8; ++j) {
+                if (clockwise) {
+                    in[j] = src.ptr<uchar>(src.rows - 1 - c - j) + r;
+                    out[j] = dst.ptr<uchar>(r + j) + c;
+                } else {
+                    in[j] = src.ptr<uchar>(c + j) + (src.cols - 1 - r - 7);
+                    out[7 - j] = dst.ptr<uchar>(r + j) + c;
+                }
             }
+            transpose8x8(in, out);
         }
+        rotatePixels<uchar>(src, dst, clockwise, r, r + 8, c, c1);
     }
+    rotatePixels<uchar>(src, dst, clockwise, r, r1, c0, c1);
+}
+#endif
 
-    return result;
+// 90 or 270 degrees in one pass over cache-sized tiles of the destination,
+// bands of tile rows split across threads
+void rotateQuarter(const cv::Mat& src, cv::Mat& dst, bool clockwise) {
+    const int tileRows = (dst.rows + TILE - 1) / TILE;
+    const int cn = src.channels();
+
+    cv::parallel_for_(cv::Range(0, tileRows), [&](const cv::Range& range) {
+        for (int tr = range.start; tr < range.end; ++tr) {
+            const int r0 = tr * TILE;
+            const int r1 = std::min(r0 + TILE, dst.rows);
+            for (int c0 = 0; c0 < dst.cols; c0 += TILE) {
+                const int c1 = std::min(c0 + TILE, dst.cols);
+                if (cn == 3) {
+                    rotatePixels<cv::Vec3b>(src, dst, clockwise, r0, r1, c0, c1);
+                } else {
+#ifdef __SSE2__
+                    rotateTileGray(src, dst, clockwise, r0, r1, c0, c1);
+#else
+                    rotatePixels<uchar>(src, dst, clockwise, r0, r1, c0, c1);
+#endif
+                }
+            }
+        }
+    });
+}
+
+// 180 degrees is a reversal of every row, read bottom-up: fully sequential
+template <typename T>
+void rotate180Rows(const cv::Mat& src, cv::Mat& dst) {
+    cv::parallel_for_(cv::Range(0, src.rows), [&](const cv::Range& range) {
+        for (int row = range.start; row < range.end; ++row) {
+            const T* in = src.ptr<T>(src.rows - 1 - row);
+            std::reverse_copy(in, in + src.cols, dst.ptr<T>(row));
+        }
+    });
+}
+
+template <typename T>
+void rotate180InPlaceRows(cv::Mat& img) {
+    // Swap row i with the reversed row (rows - 1 - i); the middle row of an odd
+    // height image is just reversed
+    for (int top = 0, bottom = img.rows - 1; top <= bottom; ++top, --bottom) {
+        T* a = img.ptr<T>(top);
+        T* b = img.ptr<T>(bottom);
+        if (top == bottom) {
+            std::reverse(a, a + img.cols);
+            break;
+        }
+        for (int col = 0; col < img.cols; ++col) {
+            std::swap(a[col], b[img.cols - 1 - col]);
+        }
+    }
+}
+
+} // namespace
+
+cv::Mat rotate90(const cv::Mat& src) {
+    return rotateMultiple90(src, 1);
 }
 
 cv::Mat rotateMultiple90(const cv::Mat& src, int rotations) {
+    cv::Mat result;
+    rotateMultiple90(src, result, rotations);
+    return result;
+}
+
+void rotateMultiple90(const cv::Mat& src, cv::Mat& dst, int rotations) {
+    CV_Assert(src.depth() == CV_8U && (src.channels() == 1 || src.channels() == 3));
+
     // Normalize rotations to 0-3 range
     rotations = ((rotations % 4) + 4) % 4;
+    const bool aliased = (dst.data == src.data);
 
-    cv::Mat result = src.clone();
+    if (rotations == 0) {
+        if (!aliased) {
+            src.copyTo(dst);
+        }
+        return;
+    }
 
-    for (int i = 0; i < rotations; ++i) {
-        result = rotate90(result);
+    if (rotations == 2) {
+        if (aliased) {
+            dst = src;
+            rotate180InPlace(dst);
+            return;
+        }
+        dst.create(src.rows, src.cols, src.type());
+        if (src.channels() == 3) {
+            rotate180Rows<cv::Vec3b>(src, dst);
+        } else {
+            rotate180Rows<uchar>(src, dst);
+        }
+        return;
     }
 
-    return result;
+    // 90 and 270 are written directly, without intermediate images. The shape
+    // changes, so writing over the source itself needs a temporary.
+    if (aliased) {
+        cv::Mat tmp(src.cols, src.rows, src.type());
+        rotateQuarter(src, tmp, rotations == 1);
+        dst = tmp;
+        return;
+    }
+    dst.create(src.cols, src.rows, src.type());
+    rotateQuarter(src, dst, rotations == 1);
+}
+
+void rotate180InPlace(cv::Mat& img) {
+    CV_Assert(img.depth() == CV_8U && (img.channels() == 1 || img.channels() == 3));
+
+    if (img.channels() == 3) {
+        rotate180InPlaceRows<cv::Vec3b>(img);
+    } else {
+        rotate180InPlaceRows<uchar>(img);
+    }
 }
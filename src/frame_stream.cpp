@@ -0,0 +1,316 @@
+#include "frame_stream.hpp"
+#include "bounded_queue.hpp"
+#include <opencv2/opencv.hpp>
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <cstdio>
+#include <exception>
+#include <filesystem>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+namespace {
+
+struct Frame {
+    cv::Mat image;
+    size_t index = 0;
+    std::string name;   // file name, for frames read from a directory
+};
+
+bool isImageFile(const fs::path& path) {
+    static const std::vector<std::string> extensions = {
+        ".png", ".jpg", ".jpeg", ".bmp", ".ppm", ".pgm", ".pnm", ".tif", ".tiff", ".webp"
+    };
+    std::string ext = path.extension().string();
+    std::transform(ext.begin(), ext.end(), ext.begin(),
+                   [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+    return std::find(extensions.begin(), extensions.end(), ext) != extensions.end();
+}
+
+// Frames from a directory of images (in file name order) or a cv::VideoCapture
+class FrameSource {
+public:
+    bool open(const std::string& input) {
+        std::error_code ec;
+        if (fs::is_directory(input, ec)) {
+            fromDirectory = true;
+            for (const auto& entry : fs::directory_iterator(input, ec)) {
+                if (entry.is_regular_file() && isImageFile(entry.path())) {
+                    files.push_back(entry.path());
+                }
+            }
+            std::sort(files.begin(), files.end());
+            return !files.empty();
+        }
+        return capture.open(input);
+    }
+
+    // Decodes the next frame; a capture reuses the buffer already in frame.image
+    bool read(Frame& frame) {
+        if (!fromDirectory) {
+            return capture.read(frame.image) && !frame.image.empty();
+        }
+        while (next < files.size()) {
+            const fs::path& path = files[next++];
+            frame.image = cv::imread(path.string(), cv::IMREAD_COLOR);
+            if (frame.image.empty()) {
+                std::cerr << "Warning: skipping unreadable image " << path.string() << std::endl;
+                continue;
+            }
+            frame.name = path.filename().string();
+            return true;
+        }
+        return false;
+    }
+
+    bool isDirectory() const { return fromDirectory; }
+
+    double fps() const {
+        double fps = fromDirectory ? 0.0 : capture.get(cv::CAP_PROP_FPS);
+        return fps > 0.0 ? fps : 25.0;
+    }
+
+private:
+    bool fromDirectory = false;
+    std::vector<fs::path> files;
+    size_t next = 0;
+    cv::VideoCapture capture;
+};
+
+// Frames to a directory, a numbered image sequence or a video file
+class FrameSink {
+public:
+    bool open(const std::string& output, bool directoryInput, double fps) {
+        if (output.empty()) {
+            std::cerr << "Error: Empty output name" << std::endl;
+            return false;
+        }
+        target = output;
+        frameRate = fps;
+
+        std::error_code ec;
+        if (output.find('%') != std::string::npos) {
+            if (!isSequencePattern(output)) {
+                std::cerr << "Error: An image sequence name needs exactly one frame number, "
+                          << "as %d or %0Nd (write a literal % as %%): " << output << std::endl;
+                return false;
+            }
+            mode = Mode::SEQUENCE;
+        } else if (directoryInput || fs::is_directory(output, ec) || output.back() == '/') {
+            mode = Mode::DIRECTORY;
+            fs::create_directories(output, ec);
+            if (ec) {
+                std::cerr << "Error: Could not create output directory " << output << std::endl;
+                return false;
+            }
+        } else {
+            mode = Mode::VIDEO;
+        }
+        return true;
+    }
+
+    bool write(const Frame& frame) {
+        switch (mode) {
+            case Mode::SEQUENCE: {
+                std::vector<char> name(target.size() + 32);
+                std::snprintf(name.data(), name.size(), target.c_str(), static_cast<int>(frame.index));
+                return cv::imwrite(name.data(), frame.image);
+            }
+            case Mode::DIRECTORY: {
+                std::string name = frame.name;
+                if (name.empty()) {
+                    char numbered[32];
+                    std::snprintf(numbered, sizeof(numbered), "%06zu.png", frame.index);
+                    name = numbered;
+                }
+                return cv::imwrite((fs::path(target) / name).string(), frame.image);
+            }
+            case Mode::VIDEO:
+                // The writer needs the frame size, known only after the effects
+                if (!writer.isOpened()) {
+                    frameSize = frame.image.size();
+                    if (!writer.open(target, fourccFor(target), frameRate, frameSize, frame.image.channels() == 3)) {
+                        return false;
+                    }
+                }
+                if (!(frame.image.size() == frameSize)) {
+                    std::cerr << "Error: frame " << frame.index << " has a different size than the first one" << std::endl;
+                    return false;
+                }
+                writer.write(frame.image);
+                return true;
+        }
+        return false;
+    }
+
+    void close() {
+        if (writer.isOpened()) {
+            writer.release();
+        }
+    }
+
+private:
+    enum class Mode { SEQUENCE, DIRECTORY, VIDEO };
+
+    // The pattern is passed to snprintf with the frame number as its only
+    // argument, so it must hold exactly one %d or %0Nd; %% is a literal '%'
+    static bool isSequencePattern(const std::string& pattern) {
+        int conversions = 0;
+        for (size_t i = 0; i < pattern.size(); ++i) {
+            if (pattern[i] != '%') {
+                continue;
+            }
+            if (++i < pattern.size() && pattern[i] == '%') {
+                continue;
+            }
+            if (i < pattern.size() && pattern[i] == '0') {
+                size_t digits = ++i;
+                while (i < pattern.size() && std::isdigit(static_cast<unsigned char>(pattern[i]))) {
+                    ++i;
+                }
+                if (i == digits || i - digits > 2) {
+                    return false;
+                }
+            }
+            if (i >= pattern.size() || pattern[i] != 'd') {
+                return false;
+            }
+            ++conversions;
+        }
+        return conversions == 1;
+    }
+
+    static int fourccFor(const std::string& file) {
+        std::string ext = fs::path(file).extension().string();
+        std::transform(ext.begin(), ext.end(), ext.begin(),
+                       [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+        if (ext == ".avi") {
+            return cv::VideoWriter::fourcc('M', 'J', 'P', 'G');
+        }
+        return cv::VideoWriter::fourcc('m', 'p', '4', 'v');
+    }
+
+    Mode mode = Mode::VIDEO;
+    std::string target;
+    double frameRate = 25.0;
+    cv::Size frameSize;
+    cv::VideoWriter writer;
+};
+
+} // namespace
+
+bool processFrameStream(const std::string& input,
+                        const std::string& output,
+                        const EffectPipeline& pipeline,
+                        size_t queueDepth) {
+    FrameSource source;
+    if (!source.open(input)) {
+        std::cerr << "Error: Could not open frame source " << input << std::endl;
+        return false;
+    }
+
+    FrameSink sink;
+    if (!sink.open(output, source.isDirectory(), source.fps())) {
+        return false;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+
+    BoundedQueue<Frame> decoded(queueDepth);
+    BoundedQueue<Frame> processed(queueDepth);
+
+    // Buffers go back to the stage that fills them, so once the queues are
+    // primed no frame needs a new allocation (except where imread allocates)
+    BoundedQueue<cv::Mat> freeInputs(queueDepth + 2);
+    BoundedQueue<cv::Mat> freeOutputs(queueDepth + 2);
+
+    std::atomic<bool> failed{false};
+    size_t framesWritten = 0;
+
+    // Any stage that throws (e.g. a cv::Exception from a malformed frame)
+    // marks the run as failed and closes both queues, so that the other
+    // stages stop and the threads can always be joined
+    auto abort = [&](const char* stage, size_t index, const std::exception& e) {
+        std::cerr << "Error: " << stage << " failed on frame " << index << ": " << e.what() << std::endl;
+        failed = true;
+        decoded.close();
+        processed.close();
+    };
+
+    // Stage 1: decode
+    std::thread decoder([&] {
+        size_t index = 0;
+        try {
+            for (;; ++index) {
+                Frame frame;
+                frame.index = index;
+                freeInputs.tryPop(frame.image);
+                if (!source.read(frame) || !decoded.push(std::move(frame))) {
+                    break;
+                }
+            }
+        } catch (const std::exception& e) {
+            abort("Decoding", index, e);
+        }
+        decoded.close();
+    });
+
+    // Stage 3: encode
+    std::thread encoder([&] {
+        Frame frame;
+        try {
+            while (processed.pop(frame)) {
+                if (!sink.write(frame)) {
+                    std::cerr << "Error: Could not write frame " << frame.index << " to " << output << std::endl;
+                    failed = true;
+                    decoded.close();
+                    processed.close();
+                    break;
+                }
+                ++framesWritten;
+                freeOutputs.tryPush(std::move(frame.image));
+            }
+        } catch (const std::exception& e) {
+            abort("Encoding", frame.index, e);
+        }
+    });
+
+    // Stage 2: effects, on this thread
+    Frame in;
+    try {
+        while (decoded.pop(in)) {
+            Frame out;
+            out.index = in.index;
+            out.name = std::move(in.name);
+            freeOutputs.tryPop(out.image);
+
+            pipeline.apply(in.image, out.image);
+
+            freeInputs.tryPush(std::move(in.image));
+            if (!processed.push(std::move(out))) {
+                break;
+            }
+        }
+    } catch (const std::exception& e) {
+        abort("Effects", in.index, e);
+    }
+    processed.close();
+
+    decoder.join();
+    encoder.join();
+    sink.close();
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "Processed " << framesWritten << " frames in " << seconds << " s";
+    if (seconds > 0.0) {
+        std::cout << " (" << framesWritten / seconds << " fps)";
+    }
+    std::cout << std::endl;
+
+    return !failed && framesWritten > 0;
+}
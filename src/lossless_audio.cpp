@@ -9,6 +9,50 @@
 #include <cmath>
 #include <iomanip>
 #include <algorithm>
+#include <thread>
+#include <future>
+#include <array>
+#include <optional>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// Version 2 files start with "GBK2". Legacy files start directly with the
+// sample rate, which can never take this value.
+static const uint32_t MAGIC_V2 = 0x47424B32;
+
+// Version 2 header flags
+static const uint32_t FLAG_MID_SIDE = 1u << 0;   // stereo coded as mid/side
+static const uint32_t FLAG_NEAR = 1u << 1;       // quantized residuals, step per channel block
+static const uint32_t FLAG_INDEPENDENT = 1u << 2; // byte-aligned self-contained blocks + offset index
+static const uint32_t FLAG_BLOCK_TYPES = 1u << 3; // 2-bit type ahead of each channel block
+static const uint32_t FLAG_PARTITIONED = 1u << 4; // partitioned Rice parameters instead of one m
+static const uint32_t FLAG_LTP = 1u << 5;         // long-term (pitch) prediction per channel block
+static const uint32_t KNOWN_FLAGS = FLAG_MID_SIDE | FLAG_NEAR | FLAG_INDEPENDENT | FLAG_BLOCK_TYPES |
+                                    FLAG_PARTITIONED | FLAG_LTP;
+
+// Long-term prediction: lag in 10 bits (0 = off), then gain (q+1)/16 in 4 bits
+static const uint32_t LTP_LAG_BITS = 10;
+static const uint32_t MIN_LTP_LAG = 16;
+static const uint32_t MAX_LTP_LAG = (1u << LTP_LAG_BITS) - 1;
+static const uint32_t LTP_GAIN_BITS = 4;
+
+// Partitioned Rice coding: partition order in 4 bits, then k in 5 bits per
+// partition. Partitions of at least 16 residuals.
+static const uint32_t MAX_PARTITION_ORDER = 8;
+static const uint32_t MIN_PARTITION_SIZE = 16;
+static const uint32_t MAX_RICE_K = 24;
+
+// How one channel of a block is stored (FLAG_BLOCK_TYPES)
+enum class BlockType : uint32_t {
+    PREDICTED = 0,   // [step] m and Golomb-coded prediction residuals
+    CONSTANT = 1,    // a single 16-bit value for the whole block, e.g. digital silence
+    VERBATIM = 2     // byte-aligned raw 16-bit samples, where Golomb coding would expand them
+};
+
+// Correction stream of the hybrid mode ("GCR2"): per block, what turns the
+// near-lossless reconstruction back into the original samples
+static const uint32_t MAGIC_CORRECTION = 0x47435232;
 
 static void showProgressBar(double fraction, uint64_t processed, uint64_t total, bool verbose) {
     if (!verbose) return;
@@ -25,10 +69,11 @@ static void showProgressBar(double fraction, uint64_t processed, uint64_t total,
 }
 
 // Predictor function: computes prediction based on order
-static int32_t computePrediction(uint32_t order, const std::vector<int16_t>& history) {
+template <typename T>
+static int32_t computePrediction(uint32_t order, const T* history) {
     // history[0] = s[n-1], history[1] = s[n-2], history[2] = s[n-3]
     int32_t pred = 0;
-    
+
     switch (order) {
         case 0:
             // No prediction
@@ -44,21 +89,659 @@ static int32_t computePrediction(uint32_t order, const std::vector<int16_t>& his
             break;
         case 3:
             // 3-tap: pred = 3*s[n-1] - 3*s[n-2] + s[n-3]
-            pred = 3 * static_cast<int32_t>(history[0]) 
-                 - 3 * static_cast<int32_t>(history[1]) 
+            pred = 3 * static_cast<int32_t>(history[0])
+                 - 3 * static_cast<int32_t>(history[1])
                  + static_cast<int32_t>(history[2]);
             break;
         default:
             pred = 0;
             break;
     }
-    
+
     // Clamp to valid 16-bit range
     return std::max<int32_t>(-32768, std::min<int32_t>(32767, pred));
 }
 
-bool encodeWavWithGolomb(const std::string& inWav, const std::string& outFile, uint32_t m, 
-                         uint32_t blockSamples, uint32_t predictorOrder, bool verbose) {
+// predictorOrder 4: adaptive NLMS cascade instead of a fixed polynomial
+static const uint32_t PREDICTOR_NLMS = 4;
+static const uint32_t MAX_PREDICTOR_ORDER = PREDICTOR_NLMS;
+
+static inline int16_t saturate16(int32_t v) {
+    return static_cast<int16_t>(std::clamp<int32_t>(v, -32768, 32767));
+}
+
+// One sign-sign NLMS stage, after the NN filters of Monkey's Audio. It
+// predicts its input from the last `order` inputs with int16 weights:
+// (w . x + 2^(shift-1)) >> shift. Once the input is known, every weight moves
+// by its adapt step in the direction of the error's sign; the step follows the
+// sign of that past input and is larger when the input was large compared to
+// the running average (the normalization), then decays over a few samples.
+// Inputs and steps live in sliding windows so the latest `order` of them are
+// always contiguous for the SIMD dot product and update.
+class NlmsFilter {
+public:
+    NlmsFilter(uint32_t order, uint32_t shift)
+        : order(order), shift(shift), weights(order, 0),
+          input(WINDOW + order, 0), adapt(WINDOW + order, 0), pos(order) {}
+
+    int32_t predict() {
+        int32_t dot = dotProduct16(&input[pos - order], weights.data(), order);
+        prediction = (dot + (1 << (shift - 1))) >> shift;
+        return prediction;
+    }
+
+    int32_t lastPrediction() const { return prediction; }
+
+    // value: the input that was predicted; uses the prediction of the last predict()
+    void update(int32_t value) {
+        int32_t err = value - prediction;
+        if (err > 0) {
+            addSteps(weights.data(), &adapt[pos - order], order, false);
+        } else if (err < 0) {
+            addSteps(weights.data(), &adapt[pos - order], order, true);
+        }
+
+        int32_t magnitude = std::abs(value);
+        int16_t step = 0;
+        if (magnitude > runningAverage * 3) step = 32;
+        else if (magnitude > (runningAverage * 4) / 3) step = 16;
+        else if (magnitude > 0) step = 8;
+        runningAverage += (magnitude - runningAverage) / 16;
+
+        input[pos] = saturate16(value);
+        adapt[pos] = (value < 0) ? -step : step;
+        adapt[pos - 1] >>= 1;
+        adapt[pos - 2] >>= 1;
+        adapt[pos - 8] >>= 1;
+
+        if (++pos == input.size()) {
+            std::copy(input.end() - order, input.end(), input.begin());
+            std::copy(adapt.end() - order, adapt.end(), adapt.begin());
+            pos = order;
+        }
+    }
+
+private:
+    static const size_t WINDOW = 512;
+
+    // Dot product with the int32 wrap-around of SSE2 pmaddwd/paddd
+    static int32_t dotProduct16(const int16_t* x, const int16_t* w, size_t n) {
+        size_t i = 0;
+        uint32_t sum = 0;
+#ifdef __SSE2__
+        __m128i acc = _mm_setzero_si128();
+        for (; i + 8 <= n; i += 8) {
+            __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(x + i));
+            __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(w + i));
+            acc = _mm_add_epi32(acc, _mm_madd_epi16(a, b));
+        }
+        acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(1, 0, 3, 2)));
+        acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(2, 3, 0, 1)));
+        sum = static_cast<uint32_t>(_mm_cvtsi128_si32(acc));
+#endif
+        for (; i < n; ++i) sum += static_cast<uint32_t>(static_cast<int32_t>(x[i]) * w[i]);
+        return static_cast<int32_t>(sum);
+    }
+
+    // w += d (or w -= d), wrapping like paddw/psubw
+    static void addSteps(int16_t* w, const int16_t* d, size_t n, bool subtract) {
+        size_t i = 0;
+#ifdef __SSE2__
+        for (; i + 8 <= n; i += 8) {
+            __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(w + i));
+            __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(d + i));
+            a = subtract ? _mm_sub_epi16(a, b) : _mm_add_epi16(a, b);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(w + i), a);
+        }
+#endif
+        for (; i < n; ++i) w[i] = static_cast<int16_t>(subtract ? w[i] - d[i] : w[i] + d[i]);
+    }
+
+    uint32_t order;
+    uint32_t shift;
+    std::vector<int16_t> weights;
+    std::vector<int16_t> input;
+    std::vector<int16_t> adapt;
+    size_t pos;
+    int32_t runningAverage = 0;
+    int32_t prediction = 0;
+};
+
+// The high-ratio predictor: a fixed first-order stage (31/32 of the last
+// input) followed by NLMS stages of order 256, 32 and 16, each predicting the
+// error left by the stages before it. All stages adapt sample by sample, in
+// the encoder and in the decoder alike.
+class NlmsCascade {
+public:
+    int32_t predict() {
+        base = (last * 31) >> 5;
+        int32_t pred = base;
+        for (auto& stage : stages) pred += stage.predict();
+        return pred;
+    }
+
+    void update(int32_t value) {
+        int32_t err = value - base;
+        for (auto& stage : stages) {
+            int32_t next = err - stage.lastPrediction();
+            stage.update(err);
+            err = next;
+        }
+        last = value;
+    }
+
+private:
+    NlmsFilter stages[3] = {NlmsFilter(256, 13), NlmsFilter(32, 10), NlmsFilter(16, 11)};
+    int32_t last = 0;
+    int32_t base = 0;
+};
+
+// Prediction state of one coded channel. predict() estimates the next sample
+// and update() feeds back the sample the decoder will reconstruct, which keeps
+// encoder and decoder in lockstep even when residuals are quantized.
+//
+// With a long-term lag set, a scaled copy of the sample lag positions back is
+// taken out first, and the short-term predictor works on what is left:
+// prediction = gain * s[n-lag] + shortTerm(f), f[n] = s[n] - gain * s[n-lag].
+class ChannelPredictor {
+public:
+    explicit ChannelPredictor(uint32_t order = 0) : order(order) {
+        if (order == PREDICTOR_NLMS) cascade.emplace();
+    }
+
+    // Not const: the NLMS stages keep their predictions for update()
+    int32_t predict() {
+        if (order == PREDICTOR_NLMS) {
+            return std::clamp<int32_t>(longTermTerm() + cascade->predict(), -32768, 32767);
+        }
+        if (lag == 0) return computePrediction(order, history);
+        return std::clamp<int32_t>(longTermTerm() + computePrediction(order, filtered), -32768, 32767);
+    }
+
+    void update(int16_t sample) {
+        filtered[2] = filtered[1];
+        filtered[1] = filtered[0];
+        filtered[0] = sample - longTermTerm();
+        if (order == PREDICTOR_NLMS) cascade->update(filtered[0]);
+
+        history[2] = history[1];
+        history[1] = history[0];
+        history[0] = sample;
+
+        past[pos++ & PAST_MASK] = sample;
+    }
+
+    // lag 0 turns long-term prediction off; gain is in 1/16 units (1..16)
+    void setLongTerm(uint32_t newLag, int32_t newGain) {
+        lag = newLag;
+        gain = newGain;
+    }
+
+    // Reconstructed sample n positions back (1 = the last one)
+    int16_t pastSample(uint32_t n) const {
+        return past[(pos - n) & PAST_MASK];
+    }
+
+    uint32_t shortTermOrder() const { return order; }
+
+private:
+    // Power-of-two ring deep enough for the whitening history of
+    // searchLongTerm(), which reaches MAX_LTP_LAG + 3 samples back
+    static const uint32_t PAST_MASK = 2047;
+    static_assert(PAST_MASK + 1 >= MAX_LTP_LAG + 3 && ((PAST_MASK + 1) & PAST_MASK) == 0);
+
+    int32_t longTermTerm() const {
+        return lag ? (gain * past[(pos - lag) & PAST_MASK] + 8) >> 4 : 0;
+    }
+
+    uint32_t order;
+    int16_t history[3] = {0, 0, 0};
+    int32_t filtered[3] = {0, 0, 0};
+    std::optional<NlmsCascade> cascade;   // PREDICTOR_NLMS only
+    std::array<int16_t, PAST_MASK + 1> past{};
+    uint32_t pos = 0;
+    uint32_t lag = 0;
+    int32_t gain = 0;
+};
+
+static inline int16_t clampSample(int32_t v) {
+    return static_cast<int16_t>(std::clamp<int32_t>(v, -32768, 32767));
+}
+
+// Signed residual <-> Golomb input: 0, -1, 1, -2, 2, ... -> 0, 1, 2, 3, 4, ...
+static inline uint32_t mapResidual(int32_t resid) {
+    return (resid >= 0) ? static_cast<uint32_t>(resid) << 1u
+                        : (static_cast<uint32_t>(-resid) << 1u) - 1u;
+}
+
+static inline int32_t unmapResidual(uint32_t mapped) {
+    return (mapped & 1u) ? -static_cast<int32_t>((mapped + 1) >> 1)
+                         : static_cast<int32_t>(mapped >> 1);
+}
+
+// Golomb m for a block of residuals, from their mean magnitude (Golomb 1966):
+// alpha = mean / (mean + 1), m = ceil(-1 / log2(alpha)). Kept within the
+// 16-bit field and at least 1, which all-zero blocks would otherwise break.
+static uint32_t adaptiveM(const std::vector<int32_t>& residuals) {
+    double sumAbs = 0.0;
+    for (auto r : residuals) sumAbs += std::abs(r);
+    double meanAbs = residuals.empty() ? 1.0 : sumAbs / residuals.size();
+    if (meanAbs <= 0.0) return 1;
+
+    double alpha = meanAbs / (meanAbs + 1.0);
+    double m = std::ceil(-1.0 / std::log2(alpha));
+    return static_cast<uint32_t>(std::clamp(m, 1.0, 65535.0));
+}
+
+// Golomb code with parameter m: unary quotient, truncated binary remainder
+struct GolombParams {
+    uint32_t m;
+    uint32_t b;        // ceil(log2(m))
+    uint32_t cutoff;   // remainders below it take b-1 bits
+
+    explicit GolombParams(uint32_t m)
+        : m(m),
+          b(static_cast<uint32_t>(std::ceil(std::log2(static_cast<double>(m))))),
+          cutoff((1u << b) - m) {}
+};
+
+static void writeGolomb(BitStream& bs, const GolombParams& g, uint32_t mapped) {
+    uint32_t q = mapped / g.m;
+    uint32_t r = mapped % g.m;
+
+    for (uint32_t j = 0; j < q; ++j) bs.write_bit(0);
+    bs.write_bit(1);
+
+    if (r < g.cutoff) {
+        if (g.b > 1) bs.write_n_bits(r, g.b - 1);
+    } else {
+        bs.write_n_bits(r + g.cutoff, g.b);
+    }
+}
+
+// Returns false on EOF or corrupt data
+static bool readGolomb(BitStream& bs, const GolombParams& g, uint32_t& mapped) {
+    uint32_t q = 0;
+    int bit;
+    while ((bit = bs.read_bit()) == 0) {
+        if (++q > (1u << 20)) return false;   // runaway unary
+    }
+    if (bit == EOF) return false;
+
+    uint32_t r = 0;
+    if (g.b > 0) {
+        if (g.b > 1) r = bs.read_n_bits(g.b - 1);
+        if (r >= g.cutoff) {
+            int extraBit = bs.read_bit();
+            if (extraBit == EOF) return false;
+            r = ((r << 1) | extraBit) - g.cutoff;
+        }
+    }
+
+    mapped = q * g.m + r;
+    return true;
+}
+
+// Residuals of one channel of one block. Lossless (step 1): plain prediction
+// errors. Near-lossless: errors quantized with step = 2*maxError+1 in the
+// closed loop, and samples replaced by what the decoder will reconstruct.
+static void computeResiduals(std::vector<int16_t>& samples, ChannelPredictor& predictor,
+                             int32_t step, std::vector<int32_t>& residuals) {
+    residuals.resize(samples.size());
+    if (step == 1) {
+        for (size_t i = 0; i < samples.size(); ++i) {
+            residuals[i] = static_cast<int32_t>(samples[i]) - predictor.predict();
+            predictor.update(samples[i]);
+        }
+        return;
+    }
+
+    const int32_t half = step / 2;
+    for (size_t i = 0; i < samples.size(); ++i) {
+        int32_t pred = predictor.predict();
+        int32_t err = static_cast<int32_t>(samples[i]) - pred;
+        int32_t q = (err >= 0) ? (err + half) / step : -((half - err) / step);
+        residuals[i] = q;
+        samples[i] = clampSample(pred + q * step);
+        predictor.update(samples[i]);
+    }
+}
+
+static float dotProduct(const float* a, const float* b, size_t n) {
+    size_t i = 0;
+    float sum = 0.0f;
+#ifdef __SSE2__
+    __m128 acc0 = _mm_setzero_ps();
+    __m128 acc1 = _mm_setzero_ps();
+    for (; i + 8 <= n; i += 8) {
+        acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+        acc1 = _mm_add_ps(acc1, _mm_mul_ps(_mm_loadu_ps(a + i + 4), _mm_loadu_ps(b + i + 4)));
+    }
+    float lanes[4];
+    _mm_storeu_ps(lanes, _mm_add_ps(acc0, acc1));
+    sum = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+#endif
+    for (; i < n; ++i) sum += a[i] * b[i];
+    return sum;
+}
+
+struct LongTermParams {
+    uint32_t lag = 0;    // 0 = no long-term prediction
+    int32_t gain = 0;    // 1/16 units
+};
+
+// Long-term predictor for a block. The short-term residual of the block and
+// of the reconstructed samples before it is correlated with itself delayed by
+// every lag in [MIN_LTP_LAG, MAX_LTP_LAG]; the lag with the highest
+// normalized correlation c^2/E wins, with the least-squares gain c/E.
+// (Taking gain*s[n-lag] out before the short-term predictor takes
+// gain*r[n-lag] out of its residual r, the predictors being linear.)
+static LongTermParams searchLongTerm(const std::vector<int16_t>& samples, const ChannelPredictor& predictor) {
+    const size_t n = samples.size();
+    const size_t h = MAX_LTP_LAG;
+    // The NLMS cascade's fixed part is a first-order predictor
+    const uint32_t order = (predictor.shortTermOrder() == PREDICTOR_NLMS) ? 1 : predictor.shortTermOrder();
+
+    std::vector<int32_t> x(h + 3 + n);
+    for (size_t i = 0; i < h + 3; ++i) x[i] = predictor.pastSample(static_cast<uint32_t>(h + 3 - i));
+    std::copy(samples.begin(), samples.end(), x.begin() + h + 3);
+
+    std::vector<float> r(h + n);
+    for (size_t i = 0; i < h + n; ++i) {
+        const int32_t history[3] = {x[i + 2], x[i + 1], x[i]};
+        r[i] = static_cast<float>(x[i + 3] - computePrediction(order, history));
+    }
+    const float* cur = r.data() + h;
+
+    // Energy of the delayed window, slid one sample per lag
+    double energy = 0.0;
+    for (size_t i = 0; i < n; ++i) energy += static_cast<double>(cur[i - MIN_LTP_LAG]) * cur[i - MIN_LTP_LAG];
+
+    LongTermParams best;
+    double bestScore = 0.0;
+    double bestGain = 0.0;
+    for (uint32_t lag = MIN_LTP_LAG; lag <= MAX_LTP_LAG; ++lag) {
+        if (lag > MIN_LTP_LAG) {
+            energy += static_cast<double>(r[h - lag]) * r[h - lag] -
+                      static_cast<double>(r[h - lag + n]) * r[h - lag + n];
+        }
+        double c = dotProduct(cur, cur - lag, n);
+        if (c <= 0.0 || energy <= 1.0) continue;
+
+        double score = c * c / energy;
+        if (score > bestScore) {
+            bestScore = score;
+            bestGain = c / energy;
+            best.lag = lag;
+        }
+    }
+    if (best.lag != 0) {
+        best.gain = std::clamp<int32_t>(static_cast<int32_t>(std::lround(bestGain * 16.0)), 1, 1 << LTP_GAIN_BITS);
+    }
+    return best;
+}
+
+// Golomb codes one channel of a block: m (16 bits), then the residuals
+static void writeResidualBlock(BitStream& bs, const std::vector<int32_t>& residuals, uint32_t m) {
+    uint32_t blockM = (m == 0) ? adaptiveM(residuals) : m;
+    bs.write_n_bits(blockM, 16);
+
+    GolombParams golomb(blockM);
+    for (auto resid : residuals) {
+        writeGolomb(bs, golomb, mapResidual(resid));
+    }
+}
+
+// Verbatim channel blocks: 16-bit big-endian samples from the next byte
+// boundary, moved through the byte stream in one block rather than bit by bit
+static void writeVerbatimPlane(BitStream& bs, const std::vector<int16_t>& plane) {
+    std::vector<uint8_t> bytes(plane.size() * 2);
+    for (size_t i = 0; i < plane.size(); ++i) {
+        uint16_t v = static_cast<uint16_t>(plane[i]);
+        bytes[2 * i] = static_cast<uint8_t>(v >> 8);
+        bytes[2 * i + 1] = static_cast<uint8_t>(v);
+    }
+    bs.align();
+    bs.write_bytes(bytes.data(), bytes.size());
+}
+
+static bool readVerbatimPlane(BitStream& bs, std::vector<int16_t>& plane) {
+    std::vector<uint8_t> bytes(plane.size() * 2);
+    bs.align();
+    if (bs.read_bytes(bytes.data(), bytes.size()) != bytes.size()) return false;
+    for (size_t i = 0; i < plane.size(); ++i) {
+        plane[i] = static_cast<int16_t>((bytes[2 * i] << 8) | bytes[2 * i + 1]);
+    }
+    return true;
+}
+
+// Size in bits of what writeResidualBlock() writes for blockM, m included
+static uint64_t golombBits(const std::vector<int32_t>& residuals, uint32_t blockM) {
+    GolombParams golomb(blockM);
+    const uint32_t shortBits = (golomb.b > 1) ? golomb.b - 1 : 0;
+    uint64_t bits = 16;
+    for (auto resid : residuals) {
+        uint32_t mapped = mapResidual(resid);
+        bits += mapped / golomb.m + 1 + ((mapped % golomb.m < golomb.cutoff) ? shortBits : golomb.b);
+    }
+    return bits;
+}
+
+// A block's residuals cut into 2^order partitions, each Rice coded (Golomb
+// with m = 2^k) with its own k. Partition i covers residuals
+// [i*n >> order, (i+1)*n >> order), so any block length can be partitioned.
+struct RicePartitions {
+    uint32_t order = 0;
+    std::vector<uint32_t> k;
+    uint64_t bits = 0;   // estimated size, order and k fields included
+};
+
+static inline size_t partitionStart(size_t n, uint32_t order, size_t i) {
+    return (i * n) >> order;
+}
+
+// Picks the partition order and the k of every partition. A prefix sum of the
+// mapped residuals gives the sum of any partition at once; a partition of
+// count residuals summing to sum costs about count*(k+1) + sum/2^k bits.
+static RicePartitions chooseRicePartitions(const std::vector<int32_t>& residuals) {
+    const size_t n = residuals.size();
+    std::vector<uint64_t> prefix(n + 1, 0);
+    for (size_t i = 0; i < n; ++i) {
+        prefix[i + 1] = prefix[i] + mapResidual(residuals[i]);
+    }
+
+    RicePartitions best;
+    for (uint32_t order = 0; order <= MAX_PARTITION_ORDER; ++order) {
+        if (order > 0 && (n >> order) < MIN_PARTITION_SIZE) break;
+
+        RicePartitions candidate;
+        candidate.order = order;
+        candidate.bits = 4;
+        for (size_t i = 0; i < (size_t{1} << order); ++i) {
+            size_t start = partitionStart(n, order, i);
+            size_t end = partitionStart(n, order, i + 1);
+            uint64_t count = end - start;
+            uint64_t sum = prefix[end] - prefix[start];
+
+            uint32_t bestK = 0;
+            uint64_t bestCost = UINT64_MAX;
+            for (uint32_t k = 0; k <= MAX_RICE_K; ++k) {
+                uint64_t cost = count * (k + 1) + (sum >> k);
+                if (cost < bestCost) {
+                    bestCost = cost;
+                    bestK = k;
+                }
+            }
+            candidate.k.push_back(bestK);
+            candidate.bits += 5 + bestCost;
+        }
+        if (order == 0 || candidate.bits < best.bits) best = candidate;
+    }
+    return best;
+}
+
+static void writeRicePartitions(BitStream& bs, const std::vector<int32_t>& residuals,
+                                const RicePartitions& partitions) {
+    const size_t n = residuals.size();
+    bs.write_n_bits(partitions.order, 4);
+    for (size_t i = 0; i < partitions.k.size(); ++i) {
+        bs.write_n_bits(partitions.k[i], 5);
+
+        GolombParams rice(1u << partitions.k[i]);
+        for (size_t j = partitionStart(n, partitions.order, i); j < partitionStart(n, partitions.order, i + 1); ++j) {
+            writeGolomb(bs, rice, mapResidual(residuals[j]));
+        }
+    }
+}
+
+// write_n_bits() shifts an int, so 64-bit fields go in two halves
+static void write64(BitStream& bs, uint64_t v) {
+    bs.write_n_bits(v >> 32, 32);
+    bs.write_n_bits(v & 0xFFFFFFFFu, 32);
+}
+
+// Block index of a stream with independent blocks: block count and byte
+// offsets, then the offset of the index itself as the last 8 bytes
+static void writeBlockIndex(BitStream& bs, const std::vector<uint64_t>& offsets) {
+    bs.align();
+    uint64_t indexOffset = bs.tell();
+    bs.write_n_bits(offsets.size(), 32);
+    for (auto offset : offsets) {
+        write64(bs, offset);
+    }
+    write64(bs, indexOffset);
+}
+
+static uint64_t readBigEndian(std::istream& is, int bytes) {
+    uint64_t v = 0;
+    for (int i = 0; i < bytes; ++i) {
+        v = (v << 8) | static_cast<uint8_t>(is.get());
+    }
+    return v;
+}
+
+static bool readBlockIndex(const std::string& path, std::vector<uint64_t>& offsets) {
+    std::ifstream is(path, std::ios::binary);
+    if (!is || !is.seekg(-8, std::ios::end)) return false;
+    uint64_t indexOffset = readBigEndian(is, 8);
+    if (!is || !is.seekg(static_cast<std::streamoff>(indexOffset))) return false;
+
+    uint32_t count = readBigEndian(is, 4);
+    if (!is || count > (1u << 28)) return false;
+    offsets.resize(count);
+    for (auto& offset : offsets) {
+        offset = readBigEndian(is, 8);
+    }
+    return static_cast<bool>(is);
+}
+
+// Estimated size in bits of one block covering frames [start, end) of the
+// chunk: frame count, then per channel the type, [step] and the cheaper of
+// Golomb-coded residuals and raw samples
+static uint64_t blockCostEstimate(const std::vector<std::vector<int32_t>>& residuals,
+                                  size_t start, size_t end, uint32_t m, bool near) {
+    uint64_t bits = 32;
+    std::vector<int32_t> slice;
+    for (const auto& channelResiduals : residuals) {
+        slice.assign(channelResiduals.begin() + start, channelResiduals.begin() + end);
+        // Adaptive coding means partitioned Rice parameters
+        uint64_t predicted = ((m == 0) ? chooseRicePartitions(slice).bits : golombBits(slice, m)) +
+                             (near ? 16 : 0);
+        bits += 2 + std::min<uint64_t>(predicted, 16ull * slice.size() + 7);
+    }
+    return bits;
+}
+
+// Splits a chunk of up to maxBlock frames into blocks. Level l of the
+// analysis tiles the chunk with blocks of maxBlock >> l frames, down to
+// minBlock; every level is costed on its own thread. A block is then halved,
+// bottom-up, whenever its two halves (each split further if that pays) cost
+// less. Residuals are computed once for the whole chunk, with the
+// predictors' current state, so the estimate ignores what block-type choices
+// and predictor resets change. Returns the block lengths in order.
+static std::vector<uint32_t> partitionChunk(const std::vector<std::vector<int16_t>>& planes,
+                                            const std::vector<ChannelPredictor>& predictors,
+                                            int32_t step, uint32_t m, uint32_t maxBlock,
+                                            uint32_t minBlock) {
+    const size_t frames = planes[0].size();
+    std::vector<std::vector<int32_t>> residuals(planes.size());
+    for (size_t ch = 0; ch < planes.size(); ++ch) {
+        std::vector<int16_t> samples = planes[ch];
+        ChannelPredictor predictor = predictors[ch];
+        computeResiduals(samples, predictor, step, residuals[ch]);
+    }
+
+    // Halving stops at minBlock, and at odd sizes so that levels nest
+    std::vector<uint32_t> sizes = {maxBlock};
+    while (sizes.back() % 2 == 0 && sizes.back() / 2 >= minBlock) {
+        sizes.push_back(sizes.back() / 2);
+    }
+
+    std::vector<std::future<std::vector<uint64_t>>> levels;
+    for (uint32_t size : sizes) {
+        levels.push_back(std::async(std::launch::async, [&, size] {
+            std::vector<uint64_t> costs;
+            for (size_t start = 0; start < frames; start += size) {
+                costs.push_back(blockCostEstimate(residuals, start, std::min<size_t>(start + size, frames),
+                                                  m, step != 1));
+            }
+            return costs;
+        }));
+    }
+    std::vector<std::vector<uint64_t>> best(sizes.size());
+    for (size_t l = 0; l < sizes.size(); ++l) best[l] = levels[l].get();
+
+    // best[l][k]: cheapest coding of block k of level l; split[l][k]: whether
+    // that means halving it
+    std::vector<std::vector<char>> split(sizes.size());
+    for (size_t l = sizes.size() - 1; l-- > 0;) {
+        split[l].assign(best[l].size(), 0);
+        for (size_t k = 0; k < best[l].size(); ++k) {
+            uint64_t halves = best[l + 1][2 * k];
+            if (2 * k + 1 < best[l + 1].size()) halves += best[l + 1][2 * k + 1];
+            if (halves < best[l][k]) {
+                best[l][k] = halves;
+                split[l][k] = 1;
+            }
+        }
+    }
+
+    std::vector<uint32_t> lengths;
+    auto emit = [&](auto&& self, size_t l, size_t k) -> void {
+        if (l + 1 < sizes.size() && split[l][k]) {
+            self(self, l + 1, 2 * k);
+            if (2 * k + 1 < best[l + 1].size()) self(self, l + 1, 2 * k + 1);
+        } else {
+            size_t start = k * sizes[l];
+            lengths.push_back(static_cast<uint32_t>(std::min<size_t>(sizes[l], frames - start)));
+        }
+    };
+    emit(emit, 0, 0);
+    return lengths;
+}
+
+bool encodeWavWithGolomb(const std::string& inWav, const std::string& outFile, uint32_t m,
+                         uint32_t blockSamples, uint32_t predictorOrder, bool verbose,
+                         uint32_t maxError, const std::string& correctionFile,
+                         uint32_t minBlockSamples, bool longTermPrediction) {
+    if (blockSamples == 0 || maxError > MAX_AUDIO_ERROR) {
+        if (verbose) std::cerr << "Invalid block size or maximum error\n";
+        return false;
+    }
+    if (predictorOrder > MAX_PREDICTOR_ORDER) {
+        if (verbose) std::cerr << "Invalid predictor order: " << predictorOrder << "\n";
+        return false;
+    }
+    const bool hybrid = !correctionFile.empty();
+    if (hybrid && maxError == 0) {
+        if (verbose) std::cerr << "A correction stream needs a near-lossless error bound\n";
+        return false;
+    }
+    if (m > 65535) {
+        if (verbose) std::cerr << "Golomb m must fit in 16 bits\n";
+        return false;
+    }
+
     SF_INFO sfinfo{};
     SNDFILE* in = sf_open(inWav.c_str(), SFM_READ, &sfinfo);
     if (!in) {
@@ -75,207 +758,578 @@ bool encodeWavWithGolomb(const std::string& inWav, const std::string& outFile, u
 
     BitStream bs(ofs, STREAM_WRITE);
 
+    std::fstream cfs;
+    if (hybrid) {
+        cfs.open(correctionFile, std::ios::out | std::ios::binary);
+        if (!cfs) {
+            if (verbose) std::cerr << "Failed to open correction file: " << correctionFile << "\n";
+            sf_close(in);
+            return false;
+        }
+    }
+    BitStream cs(cfs, STREAM_WRITE);   // only used in hybrid mode
+
+    // Mid/side mixes the error of both channels into each output channel, so
+    // the per-sample bound of near-lossless coding needs plain L/R
+    uint32_t flags = 0;
+    if (sfinfo.channels == 2 && maxError == 0) flags |= FLAG_MID_SIDE;
+    if (maxError > 0) flags |= FLAG_NEAR;
+    // Hybrid files can be decoded from any block, with or without the correction
+    if (hybrid) flags |= FLAG_INDEPENDENT;
+    flags |= FLAG_BLOCK_TYPES;
+    // Adaptive m: Rice parameters per partition of each block
+    if (m == 0) flags |= FLAG_PARTITIONED;
+    if (longTermPrediction) flags |= FLAG_LTP;
+    const int32_t step = 2 * static_cast<int32_t>(maxError) + 1;
+    // blockSamples becomes the largest block when sizes are chosen per block
+    const bool variableBlocks = (minBlockSamples > 0 && minBlockSamples < blockSamples);
+
     if (verbose) {
         std::cout << "Encoding: " << inWav << " -> " << outFile << "\n";
         std::cout << "Sample rate: " << sfinfo.samplerate << ", channels: " << sfinfo.channels
                   << ", frames: " << sfinfo.frames << "\n";
         std::cout << "Block samples: " << blockSamples << ", initial m: " << (m == 0 ? "adaptive" : std::to_string(m)) << "\n";
+        if (variableBlocks) {
+            std::cout << "Variable block sizes: " << minBlockSamples << " to " << blockSamples << " frames\n";
+        }
         std::cout << "Predictor order: " << predictorOrder;
         switch (predictorOrder) {
             case 0: std::cout << " (none)\n"; break;
             case 1: std::cout << " (1-tap: s[n-1])\n"; break;
             case 2: std::cout << " (2-tap: 2*s[n-1]-s[n-2])\n"; break;
             case 3: std::cout << " (3-tap: 3*s[n-1]-3*s[n-2]+s[n-3])\n"; break;
+            case 4: std::cout << " (NLMS cascade 256/32/16)\n"; break;
         }
-        if (sfinfo.channels == 2) {
+        if (flags & FLAG_MID_SIDE) {
             std::cout << "Using Mid/Side stereo coding\n";
         }
+        if (flags & FLAG_NEAR) {
+            std::cout << "Near-lossless: error at most +-" << maxError << " (step " << step << ")\n";
+        }
+        if (hybrid) {
+            std::cout << "Hybrid: correction stream -> " << correctionFile << "\n";
+        }
     }
 
-    // Write file header (add predictor order!)
+    // File header
+    bs.write_n_bits(MAGIC_V2, 32);
     bs.write_n_bits(sfinfo.samplerate, 32);
     bs.write_n_bits(sfinfo.channels, 16);
     bs.write_n_bits(sfinfo.frames, 64);
     bs.write_n_bits(blockSamples, 32);
-    bs.write_n_bits(predictorOrder, 8);  // NEW: store predictor order
+    bs.write_n_bits(predictorOrder, 8);
+    bs.write_n_bits(flags, 8);
 
-    std::vector<short> buffer(blockSamples * sfinfo.channels);
-    
-    int numEncodedChannels = (sfinfo.channels == 2) ? 2 : sfinfo.channels;
-    
-    // Predictor history: need up to 3 previous samples per channel
-    std::vector<std::vector<int16_t>> history(numEncodedChannels, std::vector<int16_t>(3, 0));
+    if (hybrid) {
+        cs.write_n_bits(MAGIC_CORRECTION, 32);
+        cs.write_n_bits(sfinfo.channels, 16);
+        cs.write_n_bits(sfinfo.frames, 64);
+        cs.write_n_bits(blockSamples, 32);
+    }
 
-    sf_count_t readFrames;
-    uint64_t totalSamples = static_cast<uint64_t>(sfinfo.frames) * sfinfo.channels;
-    uint64_t processedSamples = 0;
+    const int channels = sfinfo.channels;
+    std::vector<short> buffer(static_cast<size_t>(blockSamples) * channels);
 
-    const size_t updateInterval = std::max<size_t>(512, blockSamples / 8);
-    size_t blockIndex = 0;
+    // Channels are coded one after the other within a block (planar), each
+    // with its own predictor state and Golomb parameter
+    std::vector<ChannelPredictor> predictors(channels, ChannelPredictor(predictorOrder));
+    std::vector<std::vector<int16_t>> chunkPlanes(channels);
+    std::vector<std::vector<int16_t>> planes(channels);
+    std::vector<int32_t> residuals;
+    std::vector<int32_t> corrections;
+    std::vector<int16_t> original;
+    std::vector<int16_t> ltpPlane;
+    std::vector<int32_t> ltpResiduals;
+    uint64_t longTermBlocks = 0;
+    uint64_t typeCounts[3] = {0, 0, 0};
+    std::vector<uint64_t> blockOffsets;
+    std::vector<uint64_t> correctionOffsets;
 
-    while ((readFrames = sf_readf_short(in, buffer.data(), blockSamples)) > 0) {
-        ++blockIndex;
+    // Size of a channel's residuals as coded, Rice partitions chosen on the way
+    auto codedBits = [&](const std::vector<int32_t>& res, RicePartitions& parts) -> uint64_t {
+        if (flags & FLAG_PARTITIONED) {
+            parts = chooseRicePartitions(res);
+            return parts.bits;
+        }
+        return golombBits(res, m);
+    };
 
-        // For stereo: convert to Mid/Side (LOSSLESS VERSION)
-        std::vector<int16_t> encodingChannels;
-        if (sfinfo.channels == 2) {
-            encodingChannels.reserve(readFrames * 2);
-            for (sf_count_t i = 0; i < readFrames; ++i) {
+    sf_count_t chunkFrames;
+    uint64_t totalSamples = static_cast<uint64_t>(sfinfo.frames) * channels;
+    uint64_t processedSamples = 0;
+    size_t blockIndex = 0;
+    int32_t worstError = 0;
+
+    // Input is read in chunks of blockSamples frames, each coded as one block
+    // or, with variable block sizes, as the blocks chosen for it
+    while ((chunkFrames = sf_readf_short(in, buffer.data(), blockSamples)) > 0) {
+        for (int ch = 0; ch < channels; ++ch) {
+            chunkPlanes[ch].resize(chunkFrames);
+        }
+        if (flags & FLAG_MID_SIDE) {
+            for (sf_count_t i = 0; i < chunkFrames; ++i) {
                 int16_t left = buffer[i * 2];
                 int16_t right = buffer[i * 2 + 1];
-                
+
                 // LOSSLESS Mid/Side transform (matches decoder exactly)
                 int16_t side = left - right;
                 int16_t mid = right + (side >> 1);  // mid = (L+R)/2 rounded toward right
-                
-                encodingChannels.push_back(mid);
-                encodingChannels.push_back(side);
+
+                chunkPlanes[0][i] = mid;
+                chunkPlanes[1][i] = side;
             }
         } else {
-            encodingChannels.assign(buffer.begin(), buffer.begin() + readFrames * sfinfo.channels);
+            for (sf_count_t i = 0; i < chunkFrames; ++i) {
+                for (int ch = 0; ch < channels; ++ch) {
+                    chunkPlanes[ch][i] = buffer[i * channels + ch];
+                }
+            }
         }
 
-        // Compute residuals for this block
-        std::vector<int32_t> residuals;
-        residuals.reserve(encodingChannels.size());
+        std::vector<uint32_t> blockLengths = {static_cast<uint32_t>(chunkFrames)};
+        if (variableBlocks) {
+            blockLengths = partitionChunk(chunkPlanes, predictors, step, m, blockSamples, minBlockSamples);
+        }
+
+        size_t blockStart = 0;
+        for (uint32_t blockFrames : blockLengths) {
+            ++blockIndex;
+            const short* blockData = buffer.data() + blockStart * channels;
+            for (int ch = 0; ch < channels; ++ch) {
+                planes[ch].assign(chunkPlanes[ch].begin() + blockStart,
+                                  chunkPlanes[ch].begin() + blockStart + blockFrames);
+            }
+            blockStart += blockFrames;
+
+            // Independent blocks start on a byte boundary with fresh predictors,
+            // so the decoder can start at any of them
+            if (flags & FLAG_INDEPENDENT) {
+                bs.align();
+                blockOffsets.push_back(bs.tell());
+                std::fill(predictors.begin(), predictors.end(), ChannelPredictor(predictorOrder));
+            }
+            if (hybrid) {
+                cs.align();
+                correctionOffsets.push_back(cs.tell());
+                cs.write_n_bits(static_cast<uint32_t>(blockFrames), 32);
+            }
+
+            bs.write_n_bits(static_cast<uint32_t>(blockFrames), 32);
+
+            for (int ch = 0; ch < channels; ++ch) {
+                std::vector<int16_t>& plane = planes[ch];
+                ChannelPredictor& predictor = predictors[ch];
+
+                // Constant blocks cost 16 bits. Otherwise predict, and keep the
+                // samples verbatim if the Golomb code would come out bigger.
+                BlockType type = BlockType::PREDICTED;
+                uint32_t blockM = m;
+                RicePartitions partitions;
+                LongTermParams longTerm;
+                predictor.setLongTerm(0, 0);
+                if (std::all_of(plane.begin(), plane.end(), [&](int16_t v) { return v == plane[0]; })) {
+                    type = BlockType::CONSTANT;
+                } else {
+                    ChannelPredictor saved = predictor;
+                    if (step != 1) original = plane;   // near-lossless overwrites plane
+                    if (flags & FLAG_LTP) longTerm = searchLongTerm(plane, saved);
 
-        for (size_t i = 0; i < static_cast<size_t>(readFrames); ++i) {
-            for (int ch = 0; ch < numEncodedChannels; ++ch) {
-                int idx = i * numEncodedChannels + ch;
-                int16_t sample = encodingChannels[idx];
+                    computeResiduals(plane, predictor, step, residuals);
+                    uint64_t predictedBits = codedBits(residuals, partitions);
 
-                // Compute prediction using selected predictor order
-                int32_t pred = computePrediction(predictorOrder, history[ch]);
+                    // Long-term prediction only where it pays for its gain field
+                    if (longTerm.lag != 0) {
+                        ChannelPredictor ltpPredictor = saved;
+                        ltpPredictor.setLongTerm(longTerm.lag, longTerm.gain);
+                        ltpPlane = (step != 1) ? original : plane;
+                        computeResiduals(ltpPlane, ltpPredictor, step, ltpResiduals);
 
-                int32_t resid = static_cast<int32_t>(sample) - pred;
-                residuals.push_back(resid);
+                        RicePartitions ltpPartitions;
+                        uint64_t ltpBits = codedBits(ltpResiduals, ltpPartitions) + LTP_GAIN_BITS;
+                        if (ltpBits < predictedBits) {
+                            predictedBits = ltpBits;
+                            plane.swap(ltpPlane);
+                            residuals.swap(ltpResiduals);
+                            partitions = ltpPartitions;
+                            predictor = ltpPredictor;
+                        } else {
+                            longTerm = LongTermParams();
+                        }
+                    }
 
-                // Update history: shift left and add new sample
-                history[ch][2] = history[ch][1];  // s[n-3] ← s[n-2]
-                history[ch][1] = history[ch][0];  // s[n-2] ← s[n-1]
-                history[ch][0] = sample;           // s[n-1] ← s[n]
+                    predictedBits += ((flags & FLAG_NEAR) ? 16 : 0) + ((flags & FLAG_LTP) ? LTP_LAG_BITS : 0);
+                    if (predictedBits > 16ull * plane.size() + 7) {
+                        type = BlockType::VERBATIM;
+                        predictor = saved;
+                        if (step != 1) plane = original;
+                        longTerm = LongTermParams();
+                    }
+                }
+                if (longTerm.lag != 0) ++longTermBlocks;
+                if (type != BlockType::PREDICTED) {
+                    for (auto v : plane) predictor.update(v);
+                }
+                ++typeCounts[static_cast<uint32_t>(type)];
+
+                if (flags & FLAG_NEAR) {
+                    for (uint32_t i = 0; i < blockFrames; ++i) {
+                        worstError = std::max(worstError, std::abs(static_cast<int32_t>(blockData[i * channels + ch]) - plane[i]));
+                    }
+                }
+
+                if (verbose && blockIndex % 10 == 1) {
+                    std::cout << "\n[block " << blockIndex << " ch " << ch << "] ";
+                    switch (type) {
+                        case BlockType::PREDICTED:
+                            if (flags & FLAG_PARTITIONED) {
+                                std::cout << (1u << partitions.order) << " Rice partitions";
+                            } else {
+                                std::cout << "m=" << blockM;
+                            }
+                            if (longTerm.lag != 0) {
+                                std::cout << ", lag " << longTerm.lag << " gain " << longTerm.gain << "/16";
+                            }
+                            break;
+                        case BlockType::CONSTANT: std::cout << "constant"; break;
+                        case BlockType::VERBATIM: std::cout << "verbatim"; break;
+                    }
+                    std::cout << " samples=" << plane.size() << "\n";
+                }
+
+                bs.write_n_bits(static_cast<uint32_t>(type), 2);
+                switch (type) {
+                    case BlockType::PREDICTED:
+                        if (flags & FLAG_NEAR) bs.write_n_bits(step, 16);
+                        if (flags & FLAG_LTP) {
+                            bs.write_n_bits(longTerm.lag, LTP_LAG_BITS);
+                            if (longTerm.lag != 0) bs.write_n_bits(longTerm.gain - 1, LTP_GAIN_BITS);
+                        }
+                        if (flags & FLAG_PARTITIONED) {
+                            writeRicePartitions(bs, residuals, partitions);
+                        } else {
+                            writeResidualBlock(bs, residuals, blockM);
+                        }
+                        break;
+                    case BlockType::CONSTANT:
+                        bs.write_n_bits(static_cast<uint16_t>(plane[0]), 16);
+                        break;
+                    case BlockType::VERBATIM:
+                        writeVerbatimPlane(bs, plane);
+                        break;
+                }
+
+                // The correction is what near-lossless coding lost, within +-maxError
+                if (hybrid) {
+                    corrections.resize(blockFrames);
+                    for (uint32_t i = 0; i < blockFrames; ++i) {
+                        corrections[i] = static_cast<int32_t>(blockData[i * channels + ch]) - planes[ch][i];
+                    }
+                    writeResidualBlock(cs, corrections, 0);
+                }
             }
         }
 
-        // Compute optimal m for this block (adaptive)
-        uint32_t blockM = m;
-        if (m == 0) {
-            // Compute mean absolute residual
-            double sumAbs = 0.0;
-            for (auto r : residuals) sumAbs += std::abs(r);
-            double meanAbs = residuals.empty() ? 1.0 : sumAbs / residuals.size();
-            
-            // Theoretically optimal m for geometric distribution (Golomb 1966)
-            // α = mean / (mean + 1)
-            // m = ceil(-1 / log₂(α))
-            double alpha = meanAbs / (meanAbs + 1.0);
-            blockM = std::ceil(-1.0 / std::log2(alpha));
+        processedSamples += static_cast<uint64_t>(chunkFrames) * channels;
+        if (verbose) {
+            double frac = totalSamples ? static_cast<double>(processedSamples) / static_cast<double>(totalSamples) : 0.0;
+            showProgressBar(std::min(frac, 1.0), processedSamples, totalSamples, verbose);
         }
+    }
 
-        uint32_t b = static_cast<uint32_t>(std::ceil(std::log2(static_cast<double>(blockM))));
-        uint32_t cutoff = (1u << b) - blockM;
-
-        // Write block header
-        bs.write_n_bits(blockM, 16);
-        bs.write_n_bits(static_cast<uint32_t>(residuals.size()), 32);
+    if (flags & FLAG_INDEPENDENT) {
+        writeBlockIndex(bs, blockOffsets);
+    }
+    bs.close();
+    if (hybrid) {
+        writeBlockIndex(cs, correctionOffsets);
+        cs.close();
+    }
+    sf_close(in);
 
-        if (verbose && blockIndex % 10 == 1) {
-            std::cout << "\n[block " << blockIndex << "] m=" << blockM << " samples=" << residuals.size() << "\n";
+    if (verbose) {
+        std::cout << "\nEncoding finished.\n";
+        if (flags & FLAG_NEAR) {
+            std::cout << "Max sample error: " << worstError << "\n";
+        }
+        std::cout << "Blocks: " << blockIndex << "\n";
+        if (flags & FLAG_LTP) {
+            std::cout << "Long-term prediction in " << longTermBlocks << " channel blocks\n";
         }
+        std::cout << "Channel blocks: " << typeCounts[0] << " predicted, " << typeCounts[1]
+                  << " constant, " << typeCounts[2] << " verbatim\n";
+        std::cout << "Output file: " << outFile << "\n";
+    }
+
+    return true;
+}
+
+// Reads one version 2 block: frame count, then each channel's [type] and
+// [step] m and residuals, constant value or raw samples. False if the block
+// is corrupt or runs past framesLeft.
+static bool decodeBlock(BitStream& bs, std::vector<ChannelPredictor>& predictors,
+                        std::vector<std::vector<int16_t>>& planes, uint64_t framesLeft,
+                        uint32_t flags, uint32_t& blockFrames) {
+    blockFrames = bs.read_n_bits(32);
+    if (blockFrames == 0 || blockFrames > framesLeft) return false;
 
-        // Golomb encode residuals
-        for (auto resid : residuals) {
-            uint32_t mapped = (resid >= 0) ? static_cast<uint32_t>(resid) << 1u
-                                          : (static_cast<uint32_t>(-resid) << 1u) - 1u;
+    for (size_t ch = 0; ch < planes.size(); ++ch) {
+        ChannelPredictor& predictor = predictors[ch];
+        std::vector<int16_t>& plane = planes[ch];
+        plane.resize(blockFrames);
+        predictor.setLongTerm(0, 0);
 
-            uint32_t q = mapped / blockM;
-            uint32_t r = mapped % blockM;
+        uint32_t type = (flags & FLAG_BLOCK_TYPES) ? static_cast<uint32_t>(bs.read_n_bits(2))
+                                                   : static_cast<uint32_t>(BlockType::PREDICTED);
+        if (type == static_cast<uint32_t>(BlockType::CONSTANT)) {
+            std::fill(plane.begin(), plane.end(), static_cast<int16_t>(bs.read_n_bits(16)));
+        } else if (type == static_cast<uint32_t>(BlockType::VERBATIM)) {
+            if (!readVerbatimPlane(bs, plane)) return false;
+        } else if (type != static_cast<uint32_t>(BlockType::PREDICTED)) {
+            return false;
+        }
+        if (type != static_cast<uint32_t>(BlockType::PREDICTED)) {
+            for (auto v : plane) predictor.update(v);
+            continue;
+        }
 
-            if (q > 10000) {
-                if (verbose) std::cerr << "\nWarning: huge q=" << q << " resid=" << resid << " m=" << blockM << "\n";
-                q = 10000;
+        int32_t step = 1;
+        if (flags & FLAG_NEAR) {
+            step = static_cast<int32_t>(bs.read_n_bits(16));
+        }
+        if (step == 0) return false;
+        if (flags & FLAG_LTP) {
+            uint32_t lag = bs.read_n_bits(LTP_LAG_BITS);
+            if (lag != 0) {
+                predictor.setLongTerm(lag, static_cast<int32_t>(bs.read_n_bits(LTP_GAIN_BITS)) + 1);
             }
+        }
 
-            for (uint32_t j = 0; j < q; ++j) bs.write_bit(0);
-            bs.write_bit(1);
+        auto decodeRun = [&](const GolombParams& golomb, size_t start, size_t end) {
+            for (size_t i = start; i < end; ++i) {
+                uint32_t mapped;
+                if (!readGolomb(bs, golomb, mapped)) return false;
+                plane[i] = clampSample(predictor.predict() + unmapResidual(mapped) * step);
+                predictor.update(plane[i]);
+            }
+            return true;
+        };
 
-            if (r < cutoff) {
-                if (b > 1) bs.write_n_bits(r, b - 1);
-            } else {
-                uint32_t adjusted = r + cutoff;
-                bs.write_n_bits(adjusted, b);
+        if (flags & FLAG_PARTITIONED) {
+            uint32_t order = bs.read_n_bits(4);
+            if (order > MAX_PARTITION_ORDER) return false;
+            for (size_t p = 0; p < (size_t{1} << order); ++p) {
+                uint32_t k = bs.read_n_bits(5);
+                if (k > MAX_RICE_K) return false;
+                if (!decodeRun(GolombParams(1u << k), partitionStart(blockFrames, order, p),
+                               partitionStart(blockFrames, order, p + 1))) return false;
             }
+        } else {
+            uint32_t blockM = bs.read_n_bits(16);
+            if (blockM == 0 || !decodeRun(GolombParams(blockM), 0, blockFrames)) return false;
+        }
+    }
+    return true;
+}
+
+// Planar channels of a decoded block -> interleaved WAV frames
+static void interleaveBlock(const std::vector<std::vector<int16_t>>& planes, uint32_t blockFrames,
+                            uint32_t flags, std::vector<short>& outBuffer) {
+    const size_t channels = planes.size();
+    outBuffer.resize(static_cast<size_t>(blockFrames) * channels);
+    if (flags & FLAG_MID_SIDE) {
+        for (uint32_t i = 0; i < blockFrames; ++i) {
+            int16_t mid = planes[0][i];
+            int16_t side = planes[1][i];
 
-            ++processedSamples;
+            // LOSSLESS inverse transform (matches encoder exactly)
+            int16_t right = mid - (side >> 1);
+            int16_t left = right + side;
 
-            if ((processedSamples % updateInterval) == 0 && verbose) {
-                double frac = totalSamples ? static_cast<double>(processedSamples) / static_cast<double>(totalSamples) : 0.0;
-                if (frac > 1.0) frac = 1.0;
-                showProgressBar(frac, processedSamples, totalSamples, verbose);
+            outBuffer[i * 2] = left;
+            outBuffer[i * 2 + 1] = right;
+        }
+    } else {
+        for (uint32_t i = 0; i < blockFrames; ++i) {
+            for (size_t ch = 0; ch < channels; ++ch) {
+                outBuffer[i * channels + ch] = planes[ch][i];
             }
         }
     }
+}
 
-    bs.close();
-    sf_close(in);
+// Version 2 blocks, one after the other
+static bool decodeBlocksV2(BitStream& bs, SNDFILE* out, uint16_t channels, uint64_t frames,
+                           uint32_t predictorOrder, uint32_t flags, bool verbose) {
+    std::vector<ChannelPredictor> predictors(channels, ChannelPredictor(predictorOrder));
+    std::vector<std::vector<int16_t>> planes(channels);
+    std::vector<short> outBuffer;
 
-    if (verbose) {
-        double frac = 1.0;
-        showProgressBar(frac, processedSamples, totalSamples, verbose);
-        std::cout << "\nEncoding finished.\n";
-        std::cout << "Output file: " << outFile << "\n";
+    uint64_t totalSamples = frames * channels;
+    uint64_t decodedFrames = 0;
+    size_t blockIndex = 0;
+
+    while (decodedFrames < frames) {
+        ++blockIndex;
+
+        uint32_t blockFrames;
+        if (!decodeBlock(bs, predictors, planes, frames - decodedFrames, flags, blockFrames)) {
+            if (verbose) std::cerr << "\nError: truncated or corrupt data in block " << blockIndex << "\n";
+            return false;
+        }
+
+        if (verbose && blockIndex % 10 == 1) {
+            std::cout << "\n[decode block " << blockIndex << "] samples=" << blockFrames << "\n";
+        }
+
+        interleaveBlock(planes, blockFrames, flags, outBuffer);
+        if (sf_writef_short(out, outBuffer.data(), blockFrames) != static_cast<sf_count_t>(blockFrames)) {
+            if (verbose) std::cerr << "Write error\n";
+            return false;
+        }
+
+        decodedFrames += blockFrames;
+        if (verbose) {
+            uint64_t processedSamples = decodedFrames * channels;
+            double frac = totalSamples ? static_cast<double>(processedSamples) / static_cast<double>(totalSamples) : 0.0;
+            showProgressBar(std::min(frac, 1.0), processedSamples, totalSamples, verbose);
+        }
     }
 
     return true;
 }
 
-bool decodeGolombToWav(const std::string& inFile, const std::string& outWav, bool verbose) {
-    std::fstream ifs(inFile, std::ios::in | std::ios::binary);
-    if (!ifs) {
-        if (verbose) std::cerr << "Failed to open input file: " << inFile << "\n";
+// Seeks to an independent block and decodes it with fresh predictors
+static bool decodeBlockAt(std::fstream& fs, uint64_t offset, uint64_t framesLeft,
+                          uint32_t predictorOrder, uint32_t flags,
+                          std::vector<std::vector<int16_t>>& planes, uint32_t& blockFrames) {
+    fs.clear();
+    if (!fs.seekg(static_cast<std::streamoff>(offset))) return false;
+
+    BitStream bs(fs, STREAM_READ);
+    std::vector<ChannelPredictor> predictors(planes.size(), ChannelPredictor(predictorOrder));
+    return decodeBlock(bs, predictors, planes, framesLeft, flags, blockFrames);
+}
+
+// Files with independent blocks are located through their block index and
+// decoded in parallel, a batch of blocks at a time, then written in order.
+// With a correction stream the original samples are restored exactly.
+// Blocks hold at most blockSamples frames each and must add up to frames.
+static bool decodeIndependentBlocks(const std::string& inFile, const std::string& correctionFile,
+                                    SNDFILE* out, uint16_t channels, uint64_t frames,
+                                    uint32_t blockSamples, uint32_t predictorOrder, uint32_t flags,
+                                    bool verbose) {
+    const bool hybrid = !correctionFile.empty();
+    std::vector<uint64_t> offsets;
+    if (blockSamples == 0 || !readBlockIndex(inFile, offsets) ||
+        offsets.size() < (frames + blockSamples - 1) / blockSamples || offsets.size() > frames) {
+        if (verbose) std::cerr << "Error: missing or corrupt block index in " << inFile << "\n";
         return false;
     }
 
-    BitStream bs(ifs, STREAM_READ);
+    std::vector<uint64_t> correctionOffsets;
+    if (hybrid) {
+        std::fstream cfs(correctionFile, std::ios::in | std::ios::binary);
+        if (!cfs) {
+            if (verbose) std::cerr << "Failed to open correction file: " << correctionFile << "\n";
+            return false;
+        }
+        BitStream cs(cfs, STREAM_READ);
+        bool matches = cs.read_n_bits(32) == MAGIC_CORRECTION && cs.read_n_bits(16) == channels &&
+                       cs.read_n_bits(64) == frames && cs.read_n_bits(32) == blockSamples;
+        if (!matches || !readBlockIndex(correctionFile, correctionOffsets) ||
+            correctionOffsets.size() != offsets.size()) {
+            if (verbose) std::cerr << "Error: " << correctionFile << " is not the correction stream of " << inFile << "\n";
+            return false;
+        }
+    }
 
-    // Read file header (including predictor order)
-    uint32_t samplerate = bs.read_n_bits(32);
-    uint16_t channels = bs.read_n_bits(16);
-    uint64_t frames = bs.read_n_bits(64);
-    uint32_t blockSamples = bs.read_n_bits(32);
-    uint32_t predictorOrder = bs.read_n_bits(8);  // NEW: read predictor order
+    const size_t workers = std::max(1u, std::thread::hardware_concurrency());
+    const size_t batchBlocks = workers * 4;
+    std::vector<std::vector<short>> batch(batchBlocks);
+    std::vector<char> batchOk(batchBlocks);
+    const uint64_t blockCount = offsets.size();
+    uint64_t totalSamples = frames * channels;
+    uint64_t decodedFrames = 0;
 
-    if (verbose) {
-        std::cout << "Decoding: " << inFile << " -> " << outWav << "\n";
-        std::cout << "Sample rate: " << samplerate << ", channels: " << channels
-                  << ", frames: " << frames << ", block size: " << blockSamples << "\n";
-        std::cout << "Predictor order: " << predictorOrder;
-        switch (predictorOrder) {
-            case 0: std::cout << " (none)\n"; break;
-            case 1: std::cout << " (1-tap)\n"; break;
-            case 2: std::cout << " (2-tap)\n"; break;
-            case 3: std::cout << " (3-tap)\n"; break;
+    for (uint64_t first = 0; first < blockCount; first += batchBlocks) {
+        const size_t count = static_cast<size_t>(std::min<uint64_t>(batchBlocks, blockCount - first));
+
+        // Worker w decodes blocks w, w + workers, ... of the batch through its own file handles
+        auto decodeShare = [&](size_t w) {
+            std::fstream fs(inFile, std::ios::in | std::ios::binary);
+            std::fstream cfs;
+            if (hybrid) cfs.open(correctionFile, std::ios::in | std::ios::binary);
+            std::vector<std::vector<int16_t>> planes(channels);
+            std::vector<std::vector<int16_t>> corrections(channels);
+
+            for (size_t j = w; j < count; j += workers) {
+                const uint64_t block = first + j;
+
+                uint32_t blockFrames = 0;
+                bool ok = decodeBlockAt(fs, offsets[block], blockSamples, predictorOrder, flags,
+                                        planes, blockFrames);
+                if (ok) interleaveBlock(planes, blockFrames, flags, batch[j]);
+
+                if (ok && hybrid) {
+                    uint32_t correctionFrames = 0;
+                    ok = decodeBlockAt(cfs, correctionOffsets[block], blockSamples, 0, 0,
+                                       corrections, correctionFrames) && correctionFrames == blockFrames;
+                    for (uint32_t i = 0; ok && i < blockFrames; ++i) {
+                        for (uint16_t ch = 0; ch < channels; ++ch) {
+                            short& sample = batch[j][static_cast<size_t>(i) * channels + ch];
+                            sample = clampSample(sample + corrections[ch][i]);
+                        }
+                    }
+                }
+                batchOk[j] = ok;
+            }
+        };
+
+        std::vector<std::thread> threads;
+        for (size_t w = 1; w < std::min(workers, count); ++w) {
+            threads.emplace_back(decodeShare, w);
         }
-        if (channels == 2) {
-            std::cout << "Using Mid/Side stereo decoding\n";
+        decodeShare(0);
+        for (auto& t : threads) t.join();
+
+        for (size_t j = 0; j < count; ++j) {
+            if (!batchOk[j]) {
+                if (verbose) std::cerr << "\nError: truncated or corrupt data in block " << (first + j + 1) << "\n";
+                return false;
+            }
+            sf_count_t blockFrames = static_cast<sf_count_t>(batch[j].size() / channels);
+            decodedFrames += blockFrames;
+            if (decodedFrames > frames) {
+                if (verbose) std::cerr << "\nError: blocks run past the end of the stream\n";
+                return false;
+            }
+            if (sf_writef_short(out, batch[j].data(), blockFrames) != blockFrames) {
+                if (verbose) std::cerr << "Write error\n";
+                return false;
+            }
         }
-    }
 
-    SF_INFO sfinfo{};
-    sfinfo.samplerate = samplerate;
-    sfinfo.channels = channels;
-    sfinfo.format = SF_FORMAT_WAV | SF_FORMAT_PCM_16;
+        if (verbose) {
+            uint64_t processedSamples = decodedFrames * channels;
+            double frac = totalSamples ? static_cast<double>(processedSamples) / static_cast<double>(totalSamples) : 0.0;
+            showProgressBar(std::min(frac, 1.0), processedSamples, totalSamples, verbose);
+        }
+    }
 
-    SNDFILE* out = sf_open(outWav.c_str(), SFM_WRITE, &sfinfo);
-    if (!out) {
-        if (verbose) std::cerr << "Failed to create output WAV: " << outWav << "\n";
-        bs.close();
+    if (decodedFrames != frames) {
+        if (verbose) std::cerr << "\nError: blocks end before the end of the stream\n";
         return false;
     }
+    return true;
+}
 
+// Files written before the version 2 format: one m per block, channels
+// interleaved sample by sample
+static bool decodeBlocksLegacy(BitStream& bs, SNDFILE* out, uint16_t channels, uint64_t frames,
+                               uint32_t predictorOrder, bool verbose) {
     uint64_t totalSamples = frames * channels;
     uint64_t processedSamples = 0;
-    
+
     int numEncodedChannels = (channels == 2) ? 2 : channels;
     std::vector<std::vector<int16_t>> history(numEncodedChannels, std::vector<int16_t>(3, 0));
 
@@ -313,8 +1367,6 @@ bool decodeGolombToWav(const std::string& inFile, const std::string& outWav, boo
                 ++q;
                 if (q > 100000) {
                     if (verbose) std::cerr << "\nError: runaway unary\n";
-                    sf_close(out);
-                    bs.close();
                     return false;
                 }
             }
@@ -335,13 +1387,12 @@ bool decodeGolombToWav(const std::string& inFile, const std::string& outWav, boo
 
             uint32_t mapped = q * blockM + r;
 
-            int32_t resid = (mapped & 1u) ? -static_cast<int32_t>((mapped + 1) >> 1)
-                                         : static_cast<int32_t>(mapped >> 1);
+            int32_t resid = unmapResidual(mapped);
 
             int ch = s % numEncodedChannels;
 
             // Use same predictor as encoder
-            int32_t pred = computePrediction(predictorOrder, history[ch]);
+            int32_t pred = computePrediction(predictorOrder, history[ch].data());
 
             int16_t sample = static_cast<int16_t>(pred + resid);
 
@@ -358,11 +1409,11 @@ bool decodeGolombToWav(const std::string& inFile, const std::string& outWav, boo
             for (size_t i = 0; i < decodedSamples.size(); i += 2) {
                 int16_t mid = decodedSamples[i];
                 int16_t side = decodedSamples[i + 1];
-                
+
                 // LOSSLESS inverse transform (matches encoder exactly)
                 int16_t right = mid - (side >> 1);
                 int16_t left = right + side;
-                
+
                 outBuffer.push_back(left);
                 outBuffer.push_back(right);
                 processedSamples += 2;
@@ -395,13 +1446,92 @@ bool decodeGolombToWav(const std::string& inFile, const std::string& outWav, boo
         sf_writef_short(out, outBuffer.data(), outBuffer.size() / channels);
     }
 
-    bs.close();
-    sf_close(out);
+    return true;
+}
+
+bool decodeGolombToWav(const std::string& inFile, const std::string& outWav, bool verbose,
+                       const std::string& correctionFile) {
+    std::fstream ifs(inFile, std::ios::in | std::ios::binary);
+    if (!ifs) {
+        if (verbose) std::cerr << "Failed to open input file: " << inFile << "\n";
+        return false;
+    }
+
+    BitStream bs(ifs, STREAM_READ);
+
+    // Read file header; legacy files have no magic and no flags
+    uint32_t first = bs.read_n_bits(32);
+    const bool version2 = (first == MAGIC_V2);
+    uint32_t samplerate = version2 ? static_cast<uint32_t>(bs.read_n_bits(32)) : first;
+    uint16_t channels = bs.read_n_bits(16);
+    uint64_t frames = bs.read_n_bits(64);
+    uint32_t blockSamples = bs.read_n_bits(32);
+    uint32_t predictorOrder = bs.read_n_bits(8);
+    uint32_t flags = version2 ? static_cast<uint32_t>(bs.read_n_bits(8)) : 0;
+
+    if (channels == 0 || (flags & ~KNOWN_FLAGS) != 0 || predictorOrder > MAX_PREDICTOR_ORDER ||
+        ((flags & FLAG_MID_SIDE) && channels != 2)) {
+        if (verbose) std::cerr << "Unsupported or corrupt file: " << inFile << "\n";
+        bs.close();
+        return false;
+    }
+    if (!correctionFile.empty() && !(flags & FLAG_INDEPENDENT)) {
+        if (verbose) std::cerr << "Not a hybrid stream, a correction file does not apply: " << inFile << "\n";
+        bs.close();
+        return false;
+    }
 
     if (verbose) {
+        std::cout << "Decoding: " << inFile << " -> " << outWav << "\n";
+        std::cout << "Sample rate: " << samplerate << ", channels: " << channels
+                  << ", frames: " << frames << ", block size: " << blockSamples << "\n";
+        std::cout << "Predictor order: " << predictorOrder;
+        switch (predictorOrder) {
+            case 0: std::cout << " (none)\n"; break;
+            case 1: std::cout << " (1-tap)\n"; break;
+            case 2: std::cout << " (2-tap)\n"; break;
+            case 3: std::cout << " (3-tap)\n"; break;
+            case 4: std::cout << " (NLMS cascade)\n"; break;
+        }
+        if (version2 ? (flags & FLAG_MID_SIDE) != 0 : channels == 2) {
+            std::cout << "Using Mid/Side stereo decoding\n";
+        }
+        if (flags & FLAG_NEAR) {
+            std::cout << "Near-lossless stream\n";
+        }
+        if (!correctionFile.empty()) {
+            std::cout << "Adding correction stream: " << correctionFile << "\n";
+        }
+    }
+
+    SF_INFO sfinfo{};
+    sfinfo.samplerate = samplerate;
+    sfinfo.channels = channels;
+    sfinfo.format = SF_FORMAT_WAV | SF_FORMAT_PCM_16;
+
+    SNDFILE* out = sf_open(outWav.c_str(), SFM_WRITE, &sfinfo);
+    if (!out) {
+        if (verbose) std::cerr << "Failed to create output WAV: " << outWav << "\n";
+        bs.close();
+        return false;
+    }
+
+    bool ok;
+    if (flags & FLAG_INDEPENDENT) {
+        bs.close();
+        ok = decodeIndependentBlocks(inFile, correctionFile, out, channels, frames, blockSamples,
+                                     predictorOrder, flags, verbose);
+    } else {
+        ok = version2 ? decodeBlocksV2(bs, out, channels, frames, predictorOrder, flags, verbose)
+                      : decodeBlocksLegacy(bs, out, channels, frames, predictorOrder, verbose);
+        bs.close();
+    }
+    sf_close(out);
+
+    if (verbose && ok) {
         std::cout << "\nDecoding finished.\n";
         std::cout << "Output file: " << outWav << "\n";
     }
 
-    return true;
-}
\ No newline at end of file
+    return ok;
+}
@@ -5,16 +5,26 @@
 
 void printUsage(const char* prog) {
     std::cerr << "Usage:\n";
-    std::cerr << "  Encode: " << prog << " encode <input.wav> <output.gblk> <blockSamples> <m> <predictorOrder> [-v]\n";
-    std::cerr << "  Decode: " << prog << " decode <input.gblk> <output.wav> [-v]\n";
+    std::cerr << "  Encode: " << prog << " encode <input.wav> <output.gblk> <blockSamples> <m> <predictorOrder> [-v] [-near N [-correction <out.gcor>]] [-minblock N] [-ltp]\n";
+    std::cerr << "  Decode: " << prog << " decode <input.gblk> <output.wav> [-v] [-correction <in.gcor>]\n";
     std::cerr << "\nParameters:\n";
     std::cerr << "  blockSamples    : Frames per block (e.g., 4096)\n";
     std::cerr << "  m               : Golomb parameter (0=adaptive, >0=fixed)\n";
-    std::cerr << "  predictorOrder  : 0=none, 1=s[n-1], 2=2*s[n-1]-s[n-2], 3=3*s[n-1]-3*s[n-2]+s[n-3]\n";
+    std::cerr << "  predictorOrder  : 0=none, 1=s[n-1], 2=2*s[n-1]-s[n-2], 3=3*s[n-1]-3*s[n-2]+s[n-3],\n";
+    std::cerr << "                    4=adaptive NLMS cascade (highest ratio, slower)\n";
     std::cerr << "  -v              : Verbose mode\n";
+    std::cerr << "  -near N         : Near-lossless, every sample within +-N of the original (0 = lossless)\n";
+    std::cerr << "  -minblock N     : Variable block sizes, from blockSamples halved down to N frames\n";
+    std::cerr << "  -ltp            : Long-term (pitch) prediction for tonal and speech material\n";
+    std::cerr << "  -correction F   : Hybrid mode, correction stream that restores the exact input from a -near file\n";
     std::cerr << "\nExamples:\n";
     std::cerr << "  " << prog << " encode input.wav out.gblk 4096 0 2 -v   # Adaptive m, 2-tap predictor\n";
     std::cerr << "  " << prog << " encode input.wav out.gblk 4096 32 1 -v  # Fixed m=32, 1-tap predictor\n";
+    std::cerr << "  " << prog << " encode input.wav out.gblk 4096 0 2 -near 4 # Bounded error +-4\n";
+    std::cerr << "  " << prog << " encode input.wav out.gblk 4096 0 2 -near 4 -correction out.gcor # Hybrid\n";
+    std::cerr << "  " << prog << " decode out.gblk exact.wav -correction out.gcor # Lossless again\n";
+    std::cerr << "  " << prog << " encode input.wav out.gblk 8192 0 2 -minblock 512 # Adaptive block sizes\n";
+    std::cerr << "  " << prog << " encode input.wav out.gblk 4096 0 4 # NLMS cascade, for archiving\n";
     std::cerr << "  " << prog << " decode out.gblk output.wav -v\n";
 }
 
@@ -26,12 +36,27 @@ int main(int argc, char** argv) {
 
     std::string cmd = argv[1];
     bool verbose = false;
+    long maxError = 0;
+    std::string correctionFile;
+    long minBlockSamples = 0;
+    bool longTermPrediction = false;
 
-    // Check for -v flag
+    // Check for flags
     for (int i = 1; i < argc; ++i) {
         if (std::string(argv[i]) == "-v") {
             verbose = true;
-            break;
+        }
+        if (std::string(argv[i]) == "-near" && i + 1 < argc) {
+            maxError = std::atol(argv[++i]);
+        }
+        if (std::string(argv[i]) == "-correction" && i + 1 < argc) {
+            correctionFile = argv[++i];
+        }
+        if (std::string(argv[i]) == "-ltp") {
+            longTermPrediction = true;
+        }
+        if (std::string(argv[i]) == "-minblock" && i + 1 < argc) {
+            minBlockSamples = std::atol(argv[++i]);
         }
     }
 
@@ -49,12 +74,29 @@ int main(int argc, char** argv) {
         uint32_t predictorOrder = std::atoi(argv[6]);
 
         // Validate predictor order
-        if (predictorOrder > 3) {
-            std::cerr << "Error: predictorOrder must be 0-3 (got " << predictorOrder << ")\n";
+        if (predictorOrder > 4) {
+            std::cerr << "Error: predictorOrder must be 0-4 (got " << predictorOrder << ")\n";
+            return 1;
+        }
+
+        if (maxError < 0 || maxError > static_cast<long>(MAX_AUDIO_ERROR)) {
+            std::cerr << "Error: -near must be 0-" << MAX_AUDIO_ERROR << " (got " << maxError << ")\n";
+            return 1;
+        }
+
+        if (minBlockSamples < 0 || minBlockSamples > static_cast<long>(blockSamples)) {
+            std::cerr << "Error: -minblock must be 0-" << blockSamples << " (got " << minBlockSamples << ")\n";
+            return 1;
+        }
+
+        if (!correctionFile.empty() && maxError == 0) {
+            std::cerr << "Error: -correction needs -near N with N > 0\n";
             return 1;
         }
 
-        bool ok = encodeWavWithGolomb(inWav, outFile, m, blockSamples, predictorOrder, verbose);
+        bool ok = encodeWavWithGolomb(inWav, outFile, m, blockSamples, predictorOrder, verbose,
+                                      static_cast<uint32_t>(maxError), correctionFile,
+                                      static_cast<uint32_t>(minBlockSamples), longTermPrediction);
         return ok ? 0 : 2;
 
     } else if (cmd == "decode") {
@@ -67,7 +109,7 @@ int main(int argc, char** argv) {
         std::string inFile = argv[2];
         std::string outWav = argv[3];
 
-        bool ok = decodeGolombToWav(inFile, outWav, verbose);
+        bool ok = decodeGolombToWav(inFile, outWav, verbose, correctionFile);
         return ok ? 0 : 2;
 
     } else {
@@ -1,6 +1,8 @@
 #include "lossless_image.hpp"
 #include "golomb.hpp"
 #include "bit_stream.h"
+#include "luma.hpp"
+#include "pnm.hpp"
 #include <fstream>
 #include <vector>
 #include <cstdint>
@@ -9,6 +11,20 @@
 #include <algorithm>
 #include <iomanip>
 #include <deque>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// File magics: "GIMG" (original header) and "GIM2" (adds NEAR and flags)
+static const uint32_t MAGIC = 0x47494D47;
+static const uint32_t MAGIC_V2 = 0x47494D32;
+
+// Version 2 header flags
+static const uint32_t FLAG_VERBATIM_BLOCKS = 1u << 0;   // 1-bit raw/Golomb switch per block
+static const uint32_t KNOWN_FLAGS = FLAG_VERBATIM_BLOCKS;
+
+// Largest NEAR whose quantization step (2*NEAR+1) fits a byte
+static const uint32_t MAX_NEAR = 127;
 
 static void showProgress(double fraction, const std::string& label, bool verbose) {
     if (!verbose) return;
@@ -75,29 +91,150 @@ static int32_t predict(ImagePredictor predictor, uint8_t left, uint8_t up, uint8
         case ImagePredictor::AVG:
             return (a + b) / 2;
             
-        case ImagePredictor::JPEG_LS: {
-            if (a == 0 && b == 0) return 0;
+        case ImagePredictor::JPEG_LS:
+            // Zero neighbours are special-cased (kept for format compatibility)
             if (a == 0) return b;
             if (b == 0) return a;
+            return jpegLSPredictor(left, up, upLeft);
             
-            if (c >= std::max(a, b)) {
-                return std::min(a, b);
-            } else if (c <= std::min(a, b)) {
-                return std::max(a, b);
-            } else {
-                return a + b - c;
-            }
-        }
+        case ImagePredictor::PAETH:
+            return paethPredictor(left, up, upLeft);
             
         default:
             return 0;
     }
 }
 
+#ifdef __SSE2__
+// Per 16-bit lane: mask ? x : y
+static inline __m128i selectLanes(__m128i mask, __m128i x, __m128i y) {
+    return _mm_or_si128(_mm_and_si128(mask, x), _mm_andnot_si128(mask, y));
+}
+
+static inline __m128i abs16(__m128i v) {
+    return _mm_max_epi16(v, _mm_sub_epi16(_mm_setzero_si128(), v));
+}
+
+// d / 2 rounded toward zero, as the scalar predictors do
+static inline __m128i halfTowardZero(__m128i d) {
+    return _mm_srai_epi16(_mm_add_epi16(d, _mm_srli_epi16(d, 15)), 1);
+}
+
+// Eight predictions at once, one pixel per 16-bit lane, same results as predict()
+template <ImagePredictor P>
+static inline __m128i predictLanes(__m128i a, __m128i b, __m128i c) {
+    if constexpr (P == ImagePredictor::NONE) {
+        return _mm_setzero_si128();
+    } else if constexpr (P == ImagePredictor::LEFT) {
+        return a;
+    } else if constexpr (P == ImagePredictor::UP) {
+        return b;
+    } else if constexpr (P == ImagePredictor::UP_LEFT) {
+        return c;
+    } else if constexpr (P == ImagePredictor::LEFT_UP_DIFF) {
+        return _mm_sub_epi16(_mm_add_epi16(a, b), c);
+    } else if constexpr (P == ImagePredictor::LEFT_AVG) {
+        return _mm_add_epi16(a, halfTowardZero(_mm_sub_epi16(b, c)));
+    } else if constexpr (P == ImagePredictor::UP_AVG) {
+        return _mm_add_epi16(b, halfTowardZero(_mm_sub_epi16(a, c)));
+    } else if constexpr (P == ImagePredictor::AVG) {
+        return _mm_srli_epi16(_mm_add_epi16(a, b), 1);
+    } else if constexpr (P == ImagePredictor::JPEG_LS) {
+        // MED is a + b - c clamped to [min(a, b), max(a, b)]
+        __m128i med = _mm_sub_epi16(_mm_add_epi16(a, b), c);
+        med = _mm_min_epi16(_mm_max_epi16(med, _mm_min_epi16(a, b)), _mm_max_epi16(a, b));
+        const __m128i zero = _mm_setzero_si128();
+        med = selectLanes(_mm_cmpeq_epi16(b, zero), a, med);
+        return selectLanes(_mm_cmpeq_epi16(a, zero), b, med);
+    } else {
+        // Paeth: a if |b - c| <= |a - c| and |b - c| <= |a + b - 2c|,
+        // else b if |a - c| <= |a + b - 2c|, else c
+        __m128i bc = _mm_sub_epi16(b, c);
+        __m128i ac = _mm_sub_epi16(a, c);
+        __m128i pa = abs16(bc);
+        __m128i pb = abs16(ac);
+        __m128i pc = abs16(_mm_add_epi16(bc, ac));
+        __m128i notA = _mm_or_si128(_mm_cmpgt_epi16(pa, pb), _mm_cmpgt_epi16(pa, pc));
+        __m128i bOrC = selectLanes(_mm_cmpgt_epi16(pb, pc), c, b);
+        return selectLanes(notA, bOrC, a);
+    }
+}
+#endif
+
+// Residuals of one row, out[x] = cur[x] - prediction, with the same zero
+// borders as the pixel loop (prev is a row of zeros for the first row).
+// SSE2 handles 16 pixels per iteration.
+template <ImagePredictor P>
+static void predictRowImpl(const uint8_t* cur, const uint8_t* prev, uint32_t width, int16_t* out) {
+    out[0] = static_cast<int16_t>(cur[0] - predict(P, 0, prev[0], 0));
+    uint32_t x = 1;
+#ifdef __SSE2__
+    const __m128i zero = _mm_setzero_si128();
+    for (; x + 16 <= width; x += 16) {
+        __m128i xv = _mm_loadu_si128(reinterpret_cast<const __m128i*>(cur + x));
+        __m128i av = _mm_loadu_si128(reinterpret_cast<const __m128i*>(cur + x - 1));
+        __m128i bv = _mm_loadu_si128(reinterpret_cast<const __m128i*>(prev + x));
+        __m128i cv = _mm_loadu_si128(reinterpret_cast<const __m128i*>(prev + x - 1));
+
+        __m128i lo = _mm_sub_epi16(_mm_unpacklo_epi8(xv, zero),
+                                   predictLanes<P>(_mm_unpacklo_epi8(av, zero),
+                                                   _mm_unpacklo_epi8(bv, zero),
+                                                   _mm_unpacklo_epi8(cv, zero)));
+        __m128i hi = _mm_sub_epi16(_mm_unpackhi_epi8(xv, zero),
+                                   predictLanes<P>(_mm_unpackhi_epi8(av, zero),
+                                                   _mm_unpackhi_epi8(bv, zero),
+                                                   _mm_unpackhi_epi8(cv, zero)));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + x), lo);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + x + 8), hi);
+    }
+#endif
+    for (; x < width; ++x) {
+        out[x] = static_cast<int16_t>(cur[x] - predict(P, cur[x - 1], prev[x], prev[x - 1]));
+    }
+}
+
+static void predictRow(ImagePredictor predictor, const uint8_t* cur, const uint8_t* prev,
+                       uint32_t width, int16_t* out) {
+    switch (predictor) {
+        case ImagePredictor::NONE: predictRowImpl<ImagePredictor::NONE>(cur, prev, width, out); break;
+        case ImagePredictor::LEFT: predictRowImpl<ImagePredictor::LEFT>(cur, prev, width, out); break;
+        case ImagePredictor::UP: predictRowImpl<ImagePredictor::UP>(cur, prev, width, out); break;
+        case ImagePredictor::UP_LEFT: predictRowImpl<ImagePredictor::UP_LEFT>(cur, prev, width, out); break;
+        case ImagePredictor::LEFT_UP_DIFF: predictRowImpl<ImagePredictor::LEFT_UP_DIFF>(cur, prev, width, out); break;
+        case ImagePredictor::LEFT_AVG: predictRowImpl<ImagePredictor::LEFT_AVG>(cur, prev, width, out); break;
+        case ImagePredictor::UP_AVG: predictRowImpl<ImagePredictor::UP_AVG>(cur, prev, width, out); break;
+        case ImagePredictor::AVG: predictRowImpl<ImagePredictor::AVG>(cur, prev, width, out); break;
+        case ImagePredictor::JPEG_LS: predictRowImpl<ImagePredictor::JPEG_LS>(cur, prev, width, out); break;
+        case ImagePredictor::PAETH: predictRowImpl<ImagePredictor::PAETH>(cur, prev, width, out); break;
+    }
+}
+
+// Near-lossless residuals of one row: the prediction error is quantized with
+// step 2*near+1, and predictions come from the reconstructed image (what the
+// decoder will see), so every pixel ends up within +-near of the original.
+// recon receives the reconstructed row; prevRecon is a row of zeros for the
+// first row.
+static void quantizeRow(ImagePredictor predictor, const uint8_t* cur, const uint8_t* prevRecon,
+                        uint8_t* recon, uint32_t width, uint32_t near, int16_t* out) {
+    const int32_t n = static_cast<int32_t>(near);
+    const int32_t step = 2 * n + 1;
+    for (uint32_t x = 0; x < width; ++x) {
+        uint8_t left = (x > 0) ? recon[x - 1] : 0;
+        uint8_t upLeft = (x > 0) ? prevRecon[x - 1] : 0;
+        int32_t pred = predict(predictor, left, prevRecon[x], upLeft);
+        int32_t err = static_cast<int32_t>(cur[x]) - pred;
+        int32_t q = (err >= 0) ? (err + n) / step : -((n - err) / step);
+        out[x] = static_cast<int16_t>(q);
+        recon[x] = static_cast<uint8_t>(std::clamp(pred + q * step, 0, 255));
+    }
+}
+
 static ImagePredictor findBestPredictor(const std::string& inputImage,
                                         const std::string& tempDir,
                                         uint32_t m,
                                         uint32_t blockSize,
+                                        ColorConversion colorConversion,
+                                        uint32_t near,
                                         bool verbose) {
     if (verbose) {
         std::cout << "\n=== Testing all predictors to find best compression ===\n";
@@ -106,11 +243,11 @@ static ImagePredictor findBestPredictor(const std::string& inputImage,
     ImagePredictor bestPredictor = ImagePredictor::JPEG_LS;
     size_t bestSize = SIZE_MAX;
     
-    for (int p = 0; p <= 8; ++p) {
+    for (int p = 0; p <= 9; ++p) {
         ImagePredictor predictor = static_cast<ImagePredictor>(p);
         std::string tempFile = tempDir + "/temp_p" + std::to_string(p) + ".gimg";
         
-        bool ok = encodeImage(inputImage, tempFile, predictor, m, blockSize, false);
+        bool ok = encodeImage(inputImage, tempFile, predictor, m, blockSize, false, false, colorConversion, near);
         
         if (ok) {
             std::ifstream check(tempFile, std::ios::binary | std::ios::ate);
@@ -119,7 +256,7 @@ static ImagePredictor findBestPredictor(const std::string& inputImage,
             
             if (verbose) {
                 const char* names[] = {"NONE", "LEFT", "UP", "UP_LEFT", "a+b-c", 
-                                      "a+(b-c)/2", "b+(a-c)/2", "(a+b)/2", "JPEG-LS"};
+                                      "a+(b-c)/2", "b+(a-c)/2", "(a+b)/2", "JPEG-LS", "PAETH"};
                 std::cout << "  Predictor " << p << " (" << names[p] << "): " 
                           << compressedSize << " bytes";
                 if (compressedSize < bestSize) {
@@ -139,7 +276,7 @@ static ImagePredictor findBestPredictor(const std::string& inputImage,
     
     if (verbose) {
         const char* names[] = {"NONE", "LEFT", "UP", "UP_LEFT", "a+b-c", 
-                              "a+(b-c)/2", "b+(a-c)/2", "(a+b)/2", "JPEG-LS"};
+                              "a+(b-c)/2", "b+(a-c)/2", "(a+b)/2", "JPEG-LS", "PAETH"};
         std::cout << "\nBest predictor: " << static_cast<int>(bestPredictor) 
                   << " (" << names[static_cast<int>(bestPredictor)] << ")\n";
         std::cout << "Best size: " << bestSize << " bytes\n\n";
@@ -154,7 +291,13 @@ bool encodeImage(const std::string& inputImage,
                  uint32_t m,
                  uint32_t blockSize,
                  bool verbose,
-                 bool autoSelectPredictor) {
+                 bool autoSelectPredictor,
+                 ColorConversion colorConversion,
+                 uint32_t near) {
+    if (near > MAX_NEAR) {
+        if (verbose) std::cerr << "Error: NEAR must be between 0 and " << MAX_NEAR << "\n";
+        return false;
+    }
     
     if (autoSelectPredictor) {
         std::string tempDir = ".";
@@ -163,40 +306,97 @@ bool encodeImage(const std::string& inputImage,
             tempDir = outputFile.substr(0, lastSlash);
         }
         
-        predictor = findBestPredictor(inputImage, tempDir, m, blockSize, verbose);
+        predictor = findBestPredictor(inputImage, tempDir, m, blockSize, colorConversion, near, verbose);
     }
     
-    std::ifstream ifs(inputImage, std::ios::binary);
-    if (!ifs) {
-        if (verbose) std::cerr << "Error: Cannot open input image: " << inputImage << "\n";
+    PnmReader reader;
+    PnmHeader header;
+    if (!reader.open(inputImage) || !reader.nextImage(header)) {
+        if (verbose) {
+            std::cerr << "Error: Cannot read input image " << inputImage;
+            if (!reader.error().empty()) std::cerr << ": " << reader.error();
+            std::cerr << "\n";
+        }
         return false;
     }
     
-    std::string magic;
-    ifs >> magic;
-    if (magic != "P5") {
-        if (verbose) std::cerr << "Error: Not a P5 PPM file\n";
+    // P5, or P7 with a single plane; color (P6, or P7 with three planes) only
+    // when it is converted to luma on the fly
+    bool colorInput = (header.depth == 3);
+    if (header.depth != 1 && !(colorInput && colorConversion != ColorConversion::NONE)) {
+        if (verbose) {
+            std::cerr << "Error: Not a grayscale (P5) image";
+            if (colorInput) std::cerr << " (use -luma to convert color input on the fly)";
+            std::cerr << "\n";
+        }
         return false;
     }
     
-    uint32_t width, height, maxVal;
-    ifs >> width >> height >> maxVal;
-    ifs.get();
+    uint32_t width = header.width;
+    uint32_t height = header.height;
     
-    if (maxVal != 255) {
-        if (verbose) std::cerr << "Error: Only 8-bit grayscale supported\n";
+    if (header.maxval != 255) {
+        if (verbose) std::cerr << "Error: Only 8-bit images supported\n";
         return false;
     }
     
-    std::vector<uint8_t> pixels(width * height);
-    ifs.read(reinterpret_cast<char*>(pixels.data()), pixels.size());
-    ifs.close();
+    // Rows are loaded on demand, just ahead of the block being encoded, so
+    // reading (and decompressing gzip input on the reader's helper thread)
+    // overlaps with the encoding itself
+    std::vector<uint8_t> pixels(static_cast<size_t>(width) * height);
+    uint32_t loadedRows = 0;
+    
+    const bool exact = (colorConversion == ColorConversion::LUMA_EXACT);
+    const size_t inRowBytes = header.rowBytes();
+    const uint32_t rowsPerChunk = std::max<uint32_t>(1, (256 * 1024) / std::max<size_t>(1, inRowBytes));
+    std::vector<uint8_t> rgb(colorInput ? rowsPerChunk * inRowBytes : 0);
+    
+    // Residuals are computed a whole row at a time as rows come in (the row
+    // kernel needs the full row above, which is always loaded first)
+    std::vector<int16_t> residualImage(pixels.size());
+    const std::vector<uint8_t> zeroRow(width, 0);
+    // Near-lossless coding predicts from the reconstruction instead
+    std::vector<uint8_t> reconstructed(near > 0 ? pixels.size() : 0);
+    
+    auto loadRows = [&](uint32_t upTo) {
+        while (loadedRows < upTo) {
+            uint32_t rows = std::min(rowsPerChunk, height - loadedRows);
+            uint8_t* dst = pixels.data() + static_cast<size_t>(loadedRows) * width;
+            if (!colorInput) {
+                if (!reader.readRows(dst, rows)) return false;
+            } else {
+                // Convert color rows to luma as they are read, straight into
+                // the prediction buffer (no temporary grayscale file)
+                if (!reader.readRows(rgb.data(), rows)) return false;
+                rgbToGray8(rgb.data(), dst, static_cast<size_t>(rows) * width, exact);
+            }
+            for (uint32_t y = loadedRows; y < loadedRows + rows; ++y) {
+                const size_t offset = static_cast<size_t>(y) * width;
+                const uint8_t* cur = pixels.data() + offset;
+                if (near == 0) {
+                    const uint8_t* prev = (y > 0) ? cur - width : zeroRow.data();
+                    predictRow(predictor, cur, prev, width, residualImage.data() + offset);
+                } else {
+                    uint8_t* recon = reconstructed.data() + offset;
+                    const uint8_t* prevRecon = (y > 0) ? recon - width : zeroRow.data();
+                    quantizeRow(predictor, cur, prevRecon, recon, width, near, residualImage.data() + offset);
+                }
+            }
+            loadedRows += rows;
+        }
+        return true;
+    };
     
     uint32_t effectiveBlockSize = (blockSize == 0) ? width : blockSize;
     
     if (verbose) {
         std::cout << "Encoding: " << inputImage << " -> " << outputFile << "\n";
-        std::cout << "Image: " << width << "x" << height << " (8-bit grayscale)\n";
+        std::cout << "Image: " << width << "x" << height << " (8-bit grayscale";
+        if (colorInput) {
+            std::cout << ", converted from color with "
+                      << (colorConversion == ColorConversion::LUMA_EXACT ? "exact" : "fast") << " luma weights";
+        }
+        std::cout << ")\n";
         std::cout << "Predictor: ";
         switch (predictor) {
             case ImagePredictor::NONE: std::cout << "0 (NONE - no prediction)\n"; break;
@@ -208,9 +408,13 @@ bool encodeImage(const std::string& inputImage,
             case ImagePredictor::UP_AVG: std::cout << "6 (UP_AVG: b+(a-c)/2)\n"; break;
             case ImagePredictor::AVG: std::cout << "7 (AVG: (a+b)/2)\n"; break;
             case ImagePredictor::JPEG_LS: std::cout << "8 (JPEG-LS nonlinear)\n"; break;
+            case ImagePredictor::PAETH: std::cout << "9 (PAETH nonlinear)\n"; break;
         }
         std::cout << "Golomb m: " << (m == 0 ? "adaptive" : std::to_string(m)) << "\n";
         std::cout << "Block size: " << effectiveBlockSize << " pixels\n";
+        if (near > 0) {
+            std::cout << "Near-lossless: NEAR=" << near << " (error at most +-" << near << " per pixel)\n";
+        }
     }
     
     std::fstream ofs(outputFile, std::ios::out | std::ios::binary);
@@ -221,39 +425,34 @@ bool encodeImage(const std::string& inputImage,
     
     BitStream bs(ofs, STREAM_WRITE);
     
-    const uint32_t MAGIC = 0x47494D47;
-    bs.write_n_bits(MAGIC, 32);
+    // Version 2 header: NEAR and flags follow the original fields
+    const uint32_t flags = FLAG_VERBATIM_BLOCKS;
+    bs.write_n_bits(MAGIC_V2, 32);
     bs.write_n_bits(width, 32);
     bs.write_n_bits(height, 32);
     bs.write_n_bits(static_cast<uint8_t>(predictor), 8);
     bs.write_n_bits(m == 0 ? 0 : 255, 8);
     bs.write_n_bits(effectiveBlockSize, 32);
+    bs.write_n_bits(near, 8);
+    bs.write_n_bits(flags, 8);
     
     uint64_t totalPixels = static_cast<uint64_t>(width) * height;
     uint64_t processedPixels = 0;
+    uint64_t verbatimBlocks = 0;
     
     for (uint64_t blockStart = 0; blockStart < totalPixels; blockStart += effectiveBlockSize) {
         uint32_t currentBlockSize = std::min<uint32_t>(effectiveBlockSize, totalPixels - blockStart);
         
-        std::vector<int32_t> residuals;
-        residuals.reserve(currentBlockSize);
-        
-        for (uint32_t i = 0; i < currentBlockSize; ++i) {
-            uint64_t pixelIndex = blockStart + i;
-            uint32_t y = pixelIndex / width;
-            uint32_t x = pixelIndex % width;
-            
-            uint8_t pixel = pixels[pixelIndex];
-            
-            uint8_t left = (x > 0) ? pixels[y * width + (x - 1)] : 0;
-            uint8_t up = (y > 0) ? pixels[(y - 1) * width + x] : 0;
-            uint8_t upLeft = (x > 0 && y > 0) ? pixels[(y - 1) * width + (x - 1)] : 0;
-            
-            int32_t pred = predict(predictor, left, up, upLeft);
-            int32_t resid = static_cast<int32_t>(pixel) - pred;
-            residuals.push_back(resid);
+        // The block only looks at its own rows and the one above
+        uint32_t lastRow = static_cast<uint32_t>((blockStart + currentBlockSize - 1) / width);
+        if (!loadRows(lastRow + 1)) {
+            if (verbose) std::cerr << "\nError: " << reader.error() << " in " << inputImage << "\n";
+            return false;
         }
         
+        const int16_t* blockResiduals = residualImage.data() + blockStart;
+        std::vector<int32_t> residuals(blockResiduals, blockResiduals + currentBlockSize);
+        
         uint32_t blockM = m;
         if (m == 0) {
             double sumAbs = 0.0;
@@ -270,6 +469,41 @@ bool encodeImage(const std::string& inputImage,
             if (blockM == 0) blockM = 1;
         }
         
+        uint32_t b = static_cast<uint32_t>(std::ceil(std::log2(static_cast<double>(blockM))));
+        uint32_t cutoff = (1u << b) - blockM;
+        
+        if (b == 0) b = 1;
+        
+        // Noise-like blocks can cost more than 8 bits per pixel once Golomb
+        // coded; those are stored raw instead, byte-aligned so the decoder
+        // copies them. Near-lossless stores the reconstruction, which keeps
+        // the decoder's predictions in step with the encoder's.
+        uint64_t golombBits = (m == 0) ? 8 : 0;
+        for (auto resid : residuals) {
+            uint32_t mapped = (resid >= 0) ? static_cast<uint32_t>(resid) << 1u
+                                          : (static_cast<uint32_t>(-resid) << 1u) - 1u;
+            golombBits += mapped / blockM + 1 + ((mapped % blockM < cutoff) ? (b > 1 ? b - 1 : 0) : b);
+        }
+        if (golombBits > 8ull * currentBlockSize + 7) {
+            const uint8_t* raw = (near > 0 ? reconstructed.data() : pixels.data()) + blockStart;
+            bs.write_bit(1);
+            bs.align();
+            bs.write_bytes(raw, currentBlockSize);
+            ++verbatimBlocks;
+            
+            if (verbose && blockStart < 20000) {
+                std::cout << "\n[Encoder Block " << (blockStart / effectiveBlockSize)
+                          << " @ pixel " << blockStart << "] verbatim, " << currentBlockSize << " bytes\n";
+            }
+            
+            processedPixels += currentBlockSize;
+            if (verbose && (processedPixels % 10000) == 0) {
+                showProgress(static_cast<double>(processedPixels) / totalPixels, "Encoding", verbose);
+            }
+            continue;
+        }
+        bs.write_bit(0);
+        
         if (verbose && blockStart < 20000) {
             std::cout << "\n[Encoder Block " << (blockStart / effectiveBlockSize) 
                       << " @ pixel " << blockStart << "]";
@@ -281,11 +515,6 @@ bool encodeImage(const std::string& inputImage,
             bs.write_n_bits(blockM, 8);
         }
         
-        uint32_t b = static_cast<uint32_t>(std::ceil(std::log2(static_cast<double>(blockM))));
-        uint32_t cutoff = (1u << b) - blockM;
-        
-        if (b == 0) b = 1;
-        
         size_t totalBitsThisBlock = 0;
         
         for (auto resid : residuals) {
@@ -339,6 +568,14 @@ bool encodeImage(const std::string& inputImage,
         double ratio = 100.0 * (1.0 - static_cast<double>(compressedSize) / originalSize);
         std::cout << "Compression:     " << std::fixed << std::setprecision(2) 
                   << ratio << "%\n";
+        std::cout << "Verbatim blocks: " << verbatimBlocks << "\n";
+        if (near > 0) {
+            int maxError = 0;
+            for (size_t i = 0; i < pixels.size(); ++i) {
+                maxError = std::max(maxError, std::abs(static_cast<int>(pixels[i]) - reconstructed[i]));
+            }
+            std::cout << "Max pixel error: " << maxError << "\n";
+        }
     }
     
     return true;
@@ -355,9 +592,8 @@ bool decodeImage(const std::string& inputFile,
 
     BitStream bs(ifs, STREAM_READ);
 
-    const uint32_t MAGIC = 0x47494D47;
     uint32_t magic = bs.read_n_bits(32);
-    if (magic != MAGIC) {
+    if (magic != MAGIC && magic != MAGIC_V2) {
         if (verbose) std::cerr << "Error: Invalid file format\n";
         return false;
     }
@@ -367,13 +603,29 @@ bool decodeImage(const std::string& inputFile,
     uint8_t predictorByte = bs.read_n_bits(8);
     uint32_t mFlag = bs.read_n_bits(8);
     uint32_t blockSize = bs.read_n_bits(32);
+    uint32_t near = 0;
+    uint32_t flags = 0;
+    if (magic == MAGIC_V2) {
+        near = bs.read_n_bits(8);
+        flags = bs.read_n_bits(8);
+        if ((flags & ~KNOWN_FLAGS) != 0 || near > MAX_NEAR) {
+            if (verbose) std::cerr << "Error: Unsupported file version\n";
+            return false;
+        }
+    }
+    const int32_t step = 2 * static_cast<int32_t>(near) + 1;
 
+    if (predictorByte > static_cast<uint8_t>(ImagePredictor::PAETH)) {
+        if (verbose) std::cerr << "Error: Unknown predictor " << static_cast<int>(predictorByte) << "\n";
+        return false;
+    }
     ImagePredictor predictor = static_cast<ImagePredictor>(predictorByte);
 
     if (verbose) {
         std::cout << "Decoding: " << inputFile << " -> " << outputImage << "\n";
         std::cout << "Image: " << width << "x" << height << "\n";
         std::cout << "Block size: " << blockSize << " pixels\n";
+        if (near > 0) std::cout << "Near-lossless: NEAR=" << near << "\n";
     }
 
     std::vector<uint8_t> pixels(width * height);
@@ -383,6 +635,20 @@ bool decodeImage(const std::string& inputFile,
     for (uint64_t blockStart = 0; blockStart < totalPixels; blockStart += blockSize) {
         uint32_t currentBlockSize = std::min<uint32_t>(blockSize, totalPixels - blockStart);
 
+        // Verbatim blocks are plain bytes from the next byte boundary
+        if ((flags & FLAG_VERBATIM_BLOCKS) && bs.read_bit() == 1) {
+            bs.align();
+            if (bs.read_bytes(pixels.data() + blockStart, currentBlockSize) != currentBlockSize) {
+                if (verbose) std::cerr << "\nError: Unexpected EOF in verbatim block at pixel " << blockStart << "\n";
+                return false;
+            }
+            processedPixels += currentBlockSize;
+            if (verbose && (processedPixels % 10000) == 0) {
+                showProgress(static_cast<double>(processedPixels) / totalPixels, "Decoding", verbose);
+            }
+            continue;
+        }
+
         uint32_t blockM = mFlag;
         if (mFlag == 0) {
             blockM = bs.read_n_bits(8);
@@ -452,7 +718,7 @@ bool decodeImage(const std::string& inputFile,
             uint8_t upLeft = (x > 0 && y > 0) ? pixels[(y - 1) * width + (x - 1)] : 0;
 
             int32_t pred = predict(predictor, left, up, upLeft);
-            int32_t pixelValue = pred + resid;
+            int32_t pixelValue = pred + resid * step;
 
             if (pixelValue < 0) pixelValue = 0;
             if (pixelValue > 255) pixelValue = 255;
@@ -468,15 +734,18 @@ bool decodeImage(const std::string& inputFile,
 
     bs.close();
 
-    std::ofstream ofs(outputImage, std::ios::binary);
-    if (!ofs) {
-        if (verbose) std::cerr << "Error: Cannot create output file\n";
+    PnmHeader header;
+    header.format = PnmFormat::PGM;
+    header.width = width;
+    header.height = height;
+    header.maxval = 255;
+
+    std::string error;
+    if (!writePnm(outputImage, header, pixels.data(), error)) {
+        if (verbose) std::cerr << "Error: " << error << "\n";
         return false;
     }
 
-    ofs << "P5\n" << width << " " << height << "\n255\n";
-    ofs.write(reinterpret_cast<const char*>(pixels.data()), pixels.size());
-
     if (verbose) {
         std::cout << "\nDecoding complete.\n";
         std::cout << "Output written: " << outputImage << "\n";
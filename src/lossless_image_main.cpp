@@ -5,9 +5,9 @@
 
 void printUsage(const char* prog) {
     std::cerr << "Usage:\n";
-    std::cerr << "  Encode: " << prog << " encode <input.ppm> <output.gimg> <predictor> <m> <blockSize> [-v] [-auto]\n";
+    std::cerr << "  Encode: " << prog << " encode <input.ppm> <output.gimg> <predictor> <m> <blockSize> [-v] [-auto] [-luma|-luma-exact] [-near N]\n";
     std::cerr << "  Decode: " << prog << " decode <input.gimg> <output.ppm> [-v]\n";
-    std::cerr << "\nPredictors (JPEG lossless modes 1-7 + JPEG-LS):\n";
+    std::cerr << "\nPredictors (JPEG lossless modes 1-7 + JPEG-LS + Paeth):\n";
     std::cerr << "  0 = NONE (no prediction - baseline)\n";
     std::cerr << "  1 = LEFT (a)\n";
     std::cerr << "  2 = UP (b)\n";
@@ -17,16 +17,23 @@ void printUsage(const char* prog) {
     std::cerr << "  6 = b + (a - c)/2\n";
     std::cerr << "  7 = (a + b)/2\n";
     std::cerr << "  8 = JPEG-LS (nonlinear - best for natural images)\n";
+    std::cerr << "  9 = PAETH (PNG nonlinear - good for synthetic graphics)\n";
     std::cerr << "  -1 = AUTO (test all and pick best) ← NEW!\n";
     std::cerr << "\nParameters:\n";
     std::cerr << "  m          : Golomb parameter (0 = adaptive, >0 = fixed)\n";
     std::cerr << "  blockSize  : Block size for adaptive m (0 = per-row, >0 = per block)\n";
     std::cerr << "  -v         : Verbose mode\n";
     std::cerr << "  -auto      : Auto-select best predictor (same as predictor=-1)\n";
+    std::cerr << "  -luma      : Accept color (P6) input, converted to gray on the fly as ppm_to_grayscale does\n";
+    std::cerr << "  -luma-exact: Same with the exact weights (as ppm_to_grayscale -exact)\n";
+    std::cerr << "  -near N    : Near-lossless, every pixel within +-N of the original (0 = lossless, max 127)\n";
     std::cerr << "\nExamples:\n";
     std::cerr << "  " << prog << " encode images/lena.ppm lena.gimg 8 0 0 -v      # JPEG-LS predictor\n";
     std::cerr << "  " << prog << " encode images/lena.ppm lena.gimg -1 0 0 -v     # Auto-select best\n";
     std::cerr << "  " << prog << " encode images/lena.ppm lena.gimg 0 0 0 -v -auto # Auto-select best\n";
+    std::cerr << "  " << prog << " encode images/lena.ppm lena.gimg 8 0 0 -luma    # Color input, no temp gray file\n";
+    std::cerr << "  " << prog << " encode images/kodak/01.256.ppm.gz k01.gimg 8 0 0 -luma # gzip input, no gunzip step\n";
+    std::cerr << "  " << prog << " encode images/lena_gray.ppm lena.gimg 8 0 0 -near 2 # Bounded error +-2\n";
     std::cerr << "  " << prog << " decode lena.gimg lena_decoded.ppm -v\n";
 }
 
@@ -39,6 +46,8 @@ int main(int argc, char** argv) {
     std::string cmd = argv[1];
     bool verbose = false;
     bool autoSelect = false;
+    ColorConversion colorConversion = ColorConversion::NONE;
+    int near = 0;
     
     // Check for flags
     for (int i = 1; i < argc; ++i) {
@@ -48,6 +57,15 @@ int main(int argc, char** argv) {
         if (std::string(argv[i]) == "-auto") {
             autoSelect = true;
         }
+        if (std::string(argv[i]) == "-luma") {
+            colorConversion = ColorConversion::LUMA_FAST;
+        }
+        if (std::string(argv[i]) == "-luma-exact") {
+            colorConversion = ColorConversion::LUMA_EXACT;
+        }
+        if (std::string(argv[i]) == "-near" && i + 1 < argc) {
+            near = std::atoi(argv[++i]);
+        }
     }
     
     if (cmd == "encode") {
@@ -69,14 +87,20 @@ int main(int argc, char** argv) {
             predictorNum = 8;  // Default fallback (JPEG-LS)
         }
         
-        if (predictorNum < -1 || predictorNum > 8) {
-            std::cerr << "Error: Invalid predictor (must be -1 to 8)\n";
+        if (predictorNum < -1 || predictorNum > 9) {
+            std::cerr << "Error: Invalid predictor (must be -1 to 9)\n";
+            return 1;
+        }
+        
+        if (near < 0 || near > 127) {
+            std::cerr << "Error: Invalid NEAR (must be 0 to 127)\n";
             return 1;
         }
         
         ImagePredictor predictor = static_cast<ImagePredictor>(predictorNum);
         
-        bool ok = encodeImage(inputImage, outputFile, predictor, m, blockSize, verbose, autoSelect);
+        bool ok = encodeImage(inputImage, outputFile, predictor, m, blockSize, verbose, autoSelect,
+                              colorConversion, static_cast<uint32_t>(near));
         return ok ? 0 : 2;
         
     } else if (cmd == "decode") {
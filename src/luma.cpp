@@ -0,0 +1,120 @@
+#include "luma.hpp"
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_SIMD 1
+#endif
+
+// Luma weights. The fast path uses Y = (77R + 150G + 29B) >> 8 (weights sum
+// to 256, so white stays 255); the exact path computes the Rec.601 formula
+// Y = floor((299R + 587G + 114B) / 1000) in integers, free of floating point
+// rounding error.
+static inline uint32_t lumaFast(uint32_t r, uint32_t g, uint32_t b) {
+    return (77 * r + 150 * g + 29 * b) >> 8;
+}
+
+static inline uint32_t lumaExact(uint32_t r, uint32_t g, uint32_t b) {
+    return (299 * r + 587 * g + 114 * b) / 1000;
+}
+
+static void rgbToGrayScalar(const uint8_t* rgb, uint8_t* gray, size_t count, bool exact) {
+    for (size_t i = 0; i < count; ++i) {
+        uint32_t r = rgb[i * 3 + 0];
+        uint32_t g = rgb[i * 3 + 1];
+        uint32_t b = rgb[i * 3 + 2];
+        gray[i] = static_cast<uint8_t>(exact ? lumaExact(r, g, b) : lumaFast(r, g, b));
+    }
+}
+
+#ifdef HAVE_X86_SIMD
+// Converts 16 pixels per iteration: three 16-byte loads are split into R, G
+// and B planes with pshufb, widened to 16 bits and weighted.
+__attribute__((target("ssse3")))
+static size_t rgbToGraySSSE3(const uint8_t* rgb, uint8_t* gray, size_t count, bool exact) {
+    // For each plane and each of the three input registers: which input byte
+    // goes to which output lane (-1 = zero)
+    const __m128i rMask0 = _mm_setr_epi8(0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+    const __m128i rMask1 = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14, -1, -1, -1, -1, -1);
+    const __m128i rMask2 = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 1, 4, 7, 10, 13);
+    const __m128i gMask0 = _mm_setr_epi8(1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+    const __m128i gMask1 = _mm_setr_epi8(-1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1);
+    const __m128i gMask2 = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14);
+    const __m128i bMask0 = _mm_setr_epi8(2, 5, 8, 11, 14, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+    const __m128i bMask1 = _mm_setr_epi8(-1, -1, -1, -1, -1, 1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1);
+    const __m128i bMask2 = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15);
+
+    const __m128i zero = _mm_setzero_si128();
+
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        const __m128i* src = reinterpret_cast<const __m128i*>(rgb + i * 3);
+        __m128i a = _mm_loadu_si128(src);
+        __m128i b = _mm_loadu_si128(src + 1);
+        __m128i c = _mm_loadu_si128(src + 2);
+
+        __m128i r = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(a, rMask0), _mm_shuffle_epi8(b, rMask1)),
+                                 _mm_shuffle_epi8(c, rMask2));
+        __m128i g = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(a, gMask0), _mm_shuffle_epi8(b, gMask1)),
+                                 _mm_shuffle_epi8(c, gMask2));
+        __m128i bl = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(a, bMask0), _mm_shuffle_epi8(b, bMask1)),
+                                  _mm_shuffle_epi8(c, bMask2));
+
+        __m128i y[2];
+        for (int half = 0; half < 2; ++half) {
+            __m128i r16 = half ? _mm_unpackhi_epi8(r, zero) : _mm_unpacklo_epi8(r, zero);
+            __m128i g16 = half ? _mm_unpackhi_epi8(g, zero) : _mm_unpacklo_epi8(g, zero);
+            __m128i b16 = half ? _mm_unpackhi_epi8(bl, zero) : _mm_unpacklo_epi8(bl, zero);
+
+            if (!exact) {
+                // 77R + 150G + 29B <= 65280 fits an unsigned 16-bit lane
+                __m128i sum = _mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(r16, _mm_set1_epi16(77)),
+                                                          _mm_mullo_epi16(g16, _mm_set1_epi16(150))),
+                                            _mm_mullo_epi16(b16, _mm_set1_epi16(29)));
+                y[half] = _mm_srli_epi16(sum, 8);
+            } else {
+                // 299R + 587G + 114B needs 18 bits: (R, G) pairs go through
+                // pmaddwd into 32-bit lanes, B is added on top
+                __m128i rgLo = _mm_unpacklo_epi16(r16, g16);
+                __m128i rgHi = _mm_unpackhi_epi16(r16, g16);
+                __m128i bLo = _mm_unpacklo_epi16(b16, zero);
+                __m128i bHi = _mm_unpackhi_epi16(b16, zero);
+                const __m128i wRG = _mm_set1_epi32((587 << 16) | 299);
+                const __m128i wB = _mm_set1_epi32(114);
+                __m128i sumLo = _mm_add_epi32(_mm_madd_epi16(rgLo, wRG), _mm_madd_epi16(bLo, wB));
+                __m128i sumHi = _mm_add_epi32(_mm_madd_epi16(rgHi, wRG), _mm_madd_epi16(bHi, wB));
+
+                // floor(x / 1000) = floor(floor(x / 8) / 125); x / 8 <= 31875
+                // fits 16 bits and the division by 125 is a multiply by
+                // 33555 / 2^22, exact over that range
+                __m128i eighths = _mm_packs_epi32(_mm_srli_epi32(sumLo, 3), _mm_srli_epi32(sumHi, 3));
+                y[half] = _mm_srli_epi16(_mm_mulhi_epu16(eighths, _mm_set1_epi16(static_cast<short>(33555))), 6);
+            }
+        }
+
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(gray + i), _mm_packus_epi16(y[0], y[1]));
+    }
+    return i;
+}
+#endif
+
+void rgbToGray8(const uint8_t* rgb, uint8_t* gray, size_t count, bool exact) {
+    size_t done = 0;
+#ifdef HAVE_X86_SIMD
+    static const bool hasSSSE3 = __builtin_cpu_supports("ssse3");
+    if (hasSSSE3) {
+        done = rgbToGraySSSE3(rgb, gray, count, exact);
+    }
+#endif
+    rgbToGrayScalar(rgb + done * 3, gray + done, count - done, exact);
+}
+
+void rgbToGray16(const uint8_t* rgb, uint8_t* gray, size_t count, bool exact) {
+    for (size_t i = 0; i < count; ++i) {
+        const uint8_t* p = rgb + i * 6;
+        uint32_t r = (static_cast<uint32_t>(p[0]) << 8) | p[1];
+        uint32_t g = (static_cast<uint32_t>(p[2]) << 8) | p[3];
+        uint32_t b = (static_cast<uint32_t>(p[4]) << 8) | p[5];
+        uint32_t y = exact ? lumaExact(r, g, b) : lumaFast(r, g, b);
+        gray[i * 2 + 0] = static_cast<uint8_t>(y >> 8);
+        gray[i * 2 + 1] = static_cast<uint8_t>(y & 0xFF);
+    }
+}
@@ -0,0 +1,624 @@
+#include "pnm.hpp"
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#ifdef PNM_HAVE_ZLIB
+#include "bounded_queue.hpp"
+#include <mutex>
+#include <thread>
+#include <zlib.h>
+#endif
+
+// Byte source behind PnmReader
+class PnmSource {
+public:
+    virtual ~PnmSource() = default;
+
+    // Copies up to count bytes into dst; returns 0 once the data is exhausted
+    virtual size_t read(uint8_t* dst, size_t count) = 0;
+
+    // Why the data ended early, empty on a clean end
+    virtual std::string error() const { return {}; }
+};
+
+namespace {
+
+// Large enough that a whole row of a typical image is one copy, and that
+// reads/writes reach the OS in big requests
+const size_t BUFFER_SIZE = 1 << 20;
+
+bool isSpace(int c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\v' || c == '\f';
+}
+
+class FileSource : public PnmSource {
+public:
+    explicit FileSource(std::FILE* file) : file(file) {}
+    ~FileSource() override { std::fclose(file); }
+
+    size_t read(uint8_t* dst, size_t count) override {
+        return std::fread(dst, 1, count, file);
+    }
+
+    std::string error() const override {
+        return std::ferror(file) ? "Read error" : "";
+    }
+
+private:
+    std::FILE* file;
+};
+
+#ifdef PNM_HAVE_ZLIB
+// Inflates a gzip file on a helper thread. Decompressed data is handed over
+// in chunks through a bounded queue, so decompression runs ahead of (and in
+// parallel with) whatever consumes the pixels, in bounded memory.
+class GzipSource : public PnmSource {
+public:
+    explicit GzipSource(std::FILE* file) : file(file), chunks(QUEUE_DEPTH) {
+        worker = std::thread(&GzipSource::inflateAll, this);
+    }
+
+    ~GzipSource() override {
+        // Unblocks the worker if the reader stopped before the end
+        chunks.close();
+        worker.join();
+        std::fclose(file);
+    }
+
+    size_t read(uint8_t* dst, size_t count) override {
+        size_t total = 0;
+        while (total < count) {
+            if (offset == chunk.size()) {
+                // Hand out what we have rather than wait for the next chunk
+                if (total > 0) break;
+                offset = 0;
+                if (!chunks.pop(chunk)) {
+                    chunk.clear();
+                    break;
+                }
+            }
+            size_t take = std::min(count - total, chunk.size() - offset);
+            std::memcpy(dst + total, chunk.data() + offset, take);
+            offset += take;
+            total += take;
+        }
+        return total;
+    }
+
+    std::string error() const override {
+        std::lock_guard<std::mutex> lock(failureMutex);
+        return failure;
+    }
+
+private:
+    static const size_t IN_CHUNK = 64 * 1024;
+    static const size_t OUT_CHUNK = 256 * 1024;
+    static const size_t QUEUE_DEPTH = 8;
+
+    void setFailure(const std::string& message) {
+        std::lock_guard<std::mutex> lock(failureMutex);
+        failure = message;
+    }
+
+    void inflateAll() {
+        z_stream zs{};
+        // 15 + 16: maximum window, gzip wrapper expected
+        if (inflateInit2(&zs, 15 + 16) != Z_OK) {
+            setFailure("Cannot initialise zlib");
+            chunks.close();
+            return;
+        }
+
+        std::vector<uint8_t> in(IN_CHUNK);
+        std::vector<uint8_t> out(OUT_CHUNK);
+        zs.next_out = out.data();
+        zs.avail_out = static_cast<uInt>(out.size());
+        int ret = Z_OK;
+
+        for (;;) {
+            if (zs.avail_out == 0) {
+                if (!chunks.push(std::move(out))) break;   // reader is gone
+                out.resize(OUT_CHUNK);
+                zs.next_out = out.data();
+                zs.avail_out = static_cast<uInt>(out.size());
+            }
+
+            if (zs.avail_in == 0) {
+                size_t got = std::fread(in.data(), 1, in.size(), file);
+                if (got == 0) {
+                    if (ret != Z_STREAM_END) setFailure("Truncated gzip data");
+                    break;
+                }
+                zs.next_in = in.data();
+                zs.avail_in = static_cast<uInt>(got);
+            }
+
+            if (ret == Z_STREAM_END) {
+                // Concatenated members decode as one stream, as with gunzip;
+                // anything else after a member is ignored
+                if (zs.next_in[0] != 0x1f) break;
+                inflateReset(&zs);
+            }
+
+            ret = inflate(&zs, Z_NO_FLUSH);
+            if (ret != Z_OK && ret != Z_STREAM_END) {
+                setFailure(std::string("Corrupt gzip data") + (zs.msg ? std::string(": ") + zs.msg : ""));
+                break;
+            }
+        }
+
+        size_t produced = OUT_CHUNK - zs.avail_out;
+        if (produced > 0) {
+            out.resize(produced);
+            chunks.push(std::move(out));
+        }
+        inflateEnd(&zs);
+        chunks.close();
+    }
+
+    std::FILE* file;
+    BoundedQueue<std::vector<uint8_t>> chunks;
+    std::thread worker;
+
+    std::vector<uint8_t> chunk;   // being consumed by read()
+    size_t offset = 0;
+
+    mutable std::mutex failureMutex;
+    std::string failure;
+};
+#endif
+
+} // namespace
+
+// ---------------------------------------------------------------------------
+// PnmReader
+// ---------------------------------------------------------------------------
+
+PnmReader::PnmReader() = default;
+
+PnmReader::~PnmReader() {
+    close();
+}
+
+bool PnmReader::open(const std::string& path) {
+    close();
+    lastError.clear();
+
+    std::FILE* file = std::fopen(path.c_str(), "rb");
+    if (!file) {
+        return fail("Cannot open " + path);
+    }
+    // Our own buffer replaces stdio's, so data is copied only once
+    std::setvbuf(file, nullptr, _IONBF, 0);
+
+    // gzip files start with 1f 8b
+    unsigned char magic[2] = {0, 0};
+    bool gzip = std::fread(magic, 1, 2, file) == 2 && magic[0] == 0x1f && magic[1] == 0x8b;
+    std::fseek(file, 0, SEEK_SET);
+
+    if (gzip) {
+#ifdef PNM_HAVE_ZLIB
+        source = std::make_unique<GzipSource>(file);
+#else
+        std::fclose(file);
+        return fail(path + " is gzip-compressed, but zlib support was not built in");
+#endif
+    } else {
+        source = std::make_unique<FileSource>(file);
+    }
+    buffer.resize(BUFFER_SIZE);
+    pos = end = 0;
+    remainingRows = 0;
+    return true;
+}
+
+void PnmReader::close() {
+    source.reset();
+    pos = end = 0;
+    remainingRows = 0;
+}
+
+bool PnmReader::fail(const std::string& message) {
+    lastError = message;
+    return false;
+}
+
+bool PnmReader::failEndOfData() {
+    std::string reason = source->error();
+    return fail(reason.empty() ? "Unexpected end of file" : reason);
+}
+
+bool PnmReader::fill() {
+    if (pos < end) return true;
+    pos = 0;
+    end = source->read(buffer.data(), buffer.size());
+    return end > 0;
+}
+
+int PnmReader::peekByte() {
+    if (!fill()) return EOF;
+    return buffer[pos];
+}
+
+int PnmReader::getByte() {
+    if (!fill()) return EOF;
+    return buffer[pos++];
+}
+
+void PnmReader::skipSpaceAndComments() {
+    for (;;) {
+        int c = peekByte();
+        if (c == '#') {
+            // Comments run to the end of the line
+            while (c != EOF && c != '\n' && c != '\r') {
+                c = getByte();
+            }
+        } else if (isSpace(c)) {
+            ++pos;
+        } else {
+            return;
+        }
+    }
+}
+
+bool PnmReader::readNumber(uint32_t& value, const char* field) {
+    skipSpaceAndComments();
+    int c = peekByte();
+    if (c == EOF || !std::isdigit(c)) {
+        return fail(std::string("Invalid ") + field + " in header");
+    }
+
+    uint64_t v = 0;
+    while (c != EOF && std::isdigit(c)) {
+        v = v * 10 + static_cast<uint64_t>(c - '0');
+        if (v > UINT32_MAX) {
+            return fail(std::string("Header ") + field + " out of range");
+        }
+        ++pos;
+        c = peekByte();
+    }
+    value = static_cast<uint32_t>(v);
+    return true;
+}
+
+bool PnmReader::readWord(std::string& word) {
+    skipSpaceAndComments();
+    word.clear();
+    int c = peekByte();
+    while (c != EOF && !isSpace(c)) {
+        word.push_back(static_cast<char>(c));
+        ++pos;
+        c = peekByte();
+    }
+    return !word.empty();
+}
+
+bool PnmReader::readBytes(uint8_t* dst, size_t count) {
+    size_t take = std::min(count, end - pos);
+    std::memcpy(dst, buffer.data() + pos, take);
+    pos += take;
+    dst += take;
+    count -= take;
+
+    // Big requests bypass the buffer and go straight into the caller's memory
+    if (count >= buffer.size()) {
+        while (count > 0) {
+            size_t got = source->read(dst, count);
+            if (got == 0) {
+                return failEndOfData();
+            }
+            dst += got;
+            count -= got;
+        }
+        return true;
+    }
+
+    while (count > 0) {
+        if (!fill()) {
+            return failEndOfData();
+        }
+        take = std::min(count, end - pos);
+        std::memcpy(dst, buffer.data() + pos, take);
+        pos += take;
+        dst += take;
+        count -= take;
+    }
+    return true;
+}
+
+bool PnmReader::skipBytes(size_t count) {
+    while (count > 0) {
+        if (!fill()) {
+            return failEndOfData();
+        }
+        size_t take = std::min(count, end - pos);
+        pos += take;
+        count -= take;
+    }
+    return true;
+}
+
+bool PnmReader::parseClassicHeader(PnmHeader& header) {
+    if (!readNumber(header.width, "width") ||
+        !readNumber(header.height, "height") ||
+        !readNumber(header.maxval, "maxval")) {
+        return false;
+    }
+    // Exactly one whitespace byte separates maxval from the raster
+    if (!isSpace(getByte())) {
+        return fail("Missing whitespace after maxval");
+    }
+    header.depth = (header.format == PnmFormat::PPM) ? 3 : 1;
+    header.tupleType.clear();
+    return true;
+}
+
+bool PnmReader::parsePamHeader(PnmHeader& header) {
+    bool haveWidth = false, haveHeight = false, haveDepth = false, haveMaxval = false;
+    header.tupleType.clear();
+
+    std::string word;
+    for (;;) {
+        if (!readWord(word)) {
+            return fail("Unexpected end of file in PAM header");
+        }
+
+        if (word == "ENDHDR") {
+            // The raster starts right after the end of this line
+            int c;
+            while ((c = getByte()) != '\n') {
+                if (c == EOF) return fail("Unexpected end of file in PAM header");
+            }
+            break;
+        } else if (word == "WIDTH") {
+            if (!readNumber(header.width, "WIDTH")) return false;
+            haveWidth = true;
+        } else if (word == "HEIGHT") {
+            if (!readNumber(header.height, "HEIGHT")) return false;
+            haveHeight = true;
+        } else if (word == "DEPTH") {
+            if (!readNumber(header.depth, "DEPTH")) return false;
+            haveDepth = true;
+        } else if (word == "MAXVAL") {
+            if (!readNumber(header.maxval, "MAXVAL")) return false;
+            haveMaxval = true;
+        } else if (word == "TUPLTYPE") {
+            // The rest of the line; repeated TUPLTYPE lines are joined by a space
+            int c = peekByte();
+            while (c == ' ' || c == '\t') {
+                ++pos;
+                c = peekByte();
+            }
+            std::string type;
+            while (c != EOF && c != '\n' && c != '\r') {
+                type.push_back(static_cast<char>(c));
+                ++pos;
+                c = peekByte();
+            }
+            while (!type.empty() && isSpace(type.back())) type.pop_back();
+            if (!header.tupleType.empty()) header.tupleType += ' ';
+            header.tupleType += type;
+        } else {
+            return fail("Unknown PAM header field " + word);
+        }
+    }
+
+    if (!haveWidth || !haveHeight || !haveDepth || !haveMaxval) {
+        return fail("Incomplete PAM header");
+    }
+    return true;
+}
+
+bool PnmReader::nextImage(PnmHeader& header) {
+    if (!source) {
+        return fail("No file open");
+    }
+    lastError.clear();
+
+    // Rows of the previous image the caller did not want
+    if (remainingRows > 0) {
+        if (!skipBytes(current.rowBytes() * remainingRows)) return false;
+        remainingRows = 0;
+    }
+
+    // Multi-image streams may have whitespace between images
+    int c = peekByte();
+    while (isSpace(c)) {
+        ++pos;
+        c = peekByte();
+    }
+    if (c == EOF) {
+        // A clean end of the stream, unless the source gave up
+        std::string reason = source->error();
+        return reason.empty() ? false : fail(reason);
+    }
+
+    int p = getByte();
+    int kind = getByte();
+    if (p != 'P' || kind < '5' || kind > '7') {
+        if (p == 'P' && kind >= '1' && kind <= '4') {
+            return fail("ASCII and bitmap PNM (P1-P4) are not supported");
+        }
+        return fail("Not a PNM file");
+    }
+
+    header.format = static_cast<PnmFormat>(kind - '0');
+    bool ok = (header.format == PnmFormat::PAM) ? parsePamHeader(header) : parseClassicHeader(header);
+    if (!ok) return false;
+
+    if (header.width == 0 || header.height == 0) {
+        return fail("Image has no pixels");
+    }
+    if (header.maxval == 0 || header.maxval > 65535) {
+        return fail("Invalid maxval " + std::to_string(header.maxval));
+    }
+    if (header.depth == 0) {
+        return fail("Invalid PAM depth");
+    }
+
+    current = header;
+    remainingRows = header.height;
+    return true;
+}
+
+bool PnmReader::readRows(uint8_t* dst, uint32_t rows) {
+    if (rows > remainingRows) {
+        return fail("Requested more rows than the image has");
+    }
+    if (!readBytes(dst, current.rowBytes() * rows)) return false;
+    remainingRows -= rows;
+    return true;
+}
+
+bool PnmReader::readImage(std::vector<uint8_t>& data) {
+    data.resize(current.rowBytes() * remainingRows);
+    return readRows(data.data(), remainingRows);
+}
+
+// ---------------------------------------------------------------------------
+// PnmWriter
+// ---------------------------------------------------------------------------
+
+PnmWriter::PnmWriter() = default;
+
+PnmWriter::~PnmWriter() {
+    close();
+}
+
+bool PnmWriter::open(const std::string& path) {
+    close();
+    lastError.clear();
+
+    file = std::fopen(path.c_str(), "wb");
+    if (!file) {
+        return fail("Cannot create " + path);
+    }
+    std::setvbuf(file, nullptr, _IONBF, 0);
+    buffer.resize(BUFFER_SIZE);
+    used = 0;
+    remainingRows = 0;
+    return true;
+}
+
+bool PnmWriter::fail(const std::string& message) {
+    lastError = message;
+    return false;
+}
+
+bool PnmWriter::flush() {
+    if (used > 0 && std::fwrite(buffer.data(), 1, used, file) != used) {
+        used = 0;
+        return fail("Write error");
+    }
+    used = 0;
+    return true;
+}
+
+bool PnmWriter::writeBytes(const uint8_t* src, size_t count) {
+    if (used + count <= buffer.size()) {
+        std::memcpy(buffer.data() + used, src, count);
+        used += count;
+        return true;
+    }
+
+    if (!flush()) return false;
+
+    if (count >= buffer.size()) {
+        if (std::fwrite(src, 1, count, file) != count) {
+            return fail("Write error");
+        }
+        return true;
+    }
+    std::memcpy(buffer.data(), src, count);
+    used = count;
+    return true;
+}
+
+bool PnmWriter::writeHeader(const PnmHeader& header) {
+    if (!file) {
+        return fail("No file open");
+    }
+    if (remainingRows > 0) {
+        return fail("Previous image is incomplete");
+    }
+
+    std::string text;
+    if (header.format == PnmFormat::PAM) {
+        text = "P7\nWIDTH " + std::to_string(header.width) +
+               "\nHEIGHT " + std::to_string(header.height) +
+               "\nDEPTH " + std::to_string(header.depth) +
+               "\nMAXVAL " + std::to_string(header.maxval) + "\n";
+        if (!header.tupleType.empty()) {
+            text += "TUPLTYPE " + header.tupleType + "\n";
+        }
+        text += "ENDHDR\n";
+    } else {
+        text = (header.format == PnmFormat::PPM ? "P6\n" : "P5\n") +
+               std::to_string(header.width) + " " + std::to_string(header.height) + "\n" +
+               std::to_string(header.maxval) + "\n";
+    }
+
+    current = header;
+    if (current.format != PnmFormat::PAM) {
+        current.depth = (current.format == PnmFormat::PPM) ? 3 : 1;
+    }
+    remainingRows = header.height;
+    return writeBytes(reinterpret_cast<const uint8_t*>(text.data()), text.size());
+}
+
+bool PnmWriter::writeRows(const uint8_t* src, uint32_t rows) {
+    if (rows > remainingRows) {
+        return fail("Writing more rows than the image has");
+    }
+    remainingRows -= rows;
+    return writeBytes(src, current.rowBytes() * rows);
+}
+
+bool PnmWriter::close() {
+    if (!file) return lastError.empty();
+
+    bool ok = flush();
+    if (std::fclose(file) != 0 && ok) {
+        ok = fail("Write error");
+    }
+    file = nullptr;
+
+    if (ok && remainingRows > 0) {
+        ok = fail("Image closed before all rows were written");
+    }
+    remainingRows = 0;
+    return ok;
+}
+
+// ---------------------------------------------------------------------------
+// Whole-image helpers
+// ---------------------------------------------------------------------------
+
+bool readPnm(const std::string& path, PnmHeader& header, std::vector<uint8_t>& data,
+             std::string& error) {
+    PnmReader reader;
+    if (!reader.open(path)) {
+        error = reader.error();
+        return false;
+    }
+    if (!reader.nextImage(header)) {
+        error = reader.error().empty() ? "No image in " + path : reader.error();
+        return false;
+    }
+    if (!reader.readImage(data)) {
+        error = reader.error();
+        return false;
+    }
+    return true;
+}
+
+bool writePnm(const std::string& path, const PnmHeader& header, const uint8_t* data,
+              std::string& error) {
+    PnmWriter writer;
+    if (!writer.open(path) || !writer.writeHeader(header) ||
+        !writer.writeRows(data, header.height) || !writer.close()) {
+        error = writer.error();
+        return false;
+    }
+    return true;
+}
@@ -1,53 +1,106 @@
+#include "luma.hpp"
+#include "pnm.hpp"
 #include <iostream>
-#include <fstream>
 #include <vector>
 #include <cstdint>
+#include <string>
+#include <algorithm>
 
 int main(int argc, char** argv) {
     if (argc < 3) {
-        std::cerr << "Usage: " << argv[0] << " input.ppm output_gray.ppm\n";
+        std::cerr << "Usage: " << argv[0] << " input.ppm output_gray.ppm [-exact]\n";
+        std::cerr << "  -exact : Y = (299R + 587G + 114B) / 1000 instead of (77R + 150G + 29B) >> 8\n";
         return 1;
     }
 
-    std::ifstream ifs(argv[1], std::ios::binary);
-    if (!ifs) {
-        std::cerr << "Error: Cannot open " << argv[1] << "\n";
-        return 1;
+    bool exact = false;
+    for (int i = 3; i < argc; ++i) {
+        if (std::string(argv[i]) == "-exact") {
+            exact = true;
+        }
     }
 
-    std::string magic;
-    ifs >> magic;
+    PnmReader reader;
+    if (!reader.open(argv[1])) {
+        std::cerr << "Error: " << reader.error() << "\n";
+        return 1;
+    }
 
-    if (magic != "P6") {
-        std::cerr << "Error: Input must be P6 (color) PPM\n";
+    PnmWriter writer;
+    if (!writer.open(argv[2])) {
+        std::cerr << "Error: " << writer.error() << "\n";
         return 1;
     }
 
-    uint32_t width, height, maxval;
-    ifs >> width >> height >> maxval;
-    ifs.ignore(1);
+    // A PPM file may hold several images back to back; each one becomes an
+    // image of the same PGM stream
+    PnmHeader header;
+    uint32_t images = 0;
+    while (reader.nextImage(header)) {
+        if (header.depth != 3) {
+            std::cerr << "Error: Input must be P6 (color) PPM\n";
+            return 1;
+        }
 
-    std::vector<uint8_t> rgb(width * height * 3);
-    ifs.read(reinterpret_cast<char*>(rgb.data()), width * height * 3);
-    ifs.close();
+        PnmHeader grayHeader;
+        grayHeader.format = PnmFormat::PGM;
+        grayHeader.width = header.width;
+        grayHeader.height = header.height;
+        grayHeader.maxval = header.maxval;
+        if (!writer.writeHeader(grayHeader)) {
+            std::cerr << "Error: " << writer.error() << "\n";
+            return 1;
+        }
 
-    // Convert RGB to grayscale using standard formula: Y = 0.299*R + 0.587*G + 0.114*B
-    std::vector<uint8_t> gray(width * height);
-    for (size_t i = 0; i < width * height; ++i) {
-        uint8_t r = rgb[i * 3 + 0];
-        uint8_t g = rgb[i * 3 + 1];
-        uint8_t b = rgb[i * 3 + 2];
-        gray[i] = static_cast<uint8_t>(0.299 * r + 0.587 * g + 0.114 * b);
-    }
+        const size_t rgbRowBytes = header.rowBytes();
+        const size_t grayRowBytes = grayHeader.rowBytes();
+        const uint32_t width = header.width;
+        const uint32_t height = header.height;
+
+        // Stream the image in chunks of rows (about 256 KiB of input each), so
+        // memory stays proportional to the width and not to the whole image
+        const size_t rowsPerChunk = std::max<size_t>(1, (256 * 1024) / std::max<size_t>(1, rgbRowBytes));
+        std::vector<uint8_t> rgb(rowsPerChunk * rgbRowBytes);
+        std::vector<uint8_t> gray(rowsPerChunk * grayRowBytes);
+
+        for (uint32_t row = 0; row < height; ) {
+            uint32_t rows = static_cast<uint32_t>(std::min<size_t>(rowsPerChunk, height - row));
+
+            if (!reader.readRows(rgb.data(), rows)) {
+                std::cerr << "Error: " << reader.error() << " in " << argv[1] << "\n";
+                return 1;
+            }
+
+            if (header.bytesPerSample() == 1) {
+                rgbToGray8(rgb.data(), gray.data(), static_cast<size_t>(rows) * width, exact);
+            } else {
+                rgbToGray16(rgb.data(), gray.data(), static_cast<size_t>(rows) * width, exact);
+            }
 
-    // Write P5 (grayscale) output
-    std::ofstream ofs(argv[2], std::ios::binary);
-    ofs << "P5\n" << width << " " << height << "\n" << maxval << "\n";
-    ofs.write(reinterpret_cast<const char*>(gray.data()), width * height);
-    ofs.close();
+            if (!writer.writeRows(gray.data(), rows)) {
+                std::cerr << "Error: " << writer.error() << "\n";
+                return 1;
+            }
+            row += rows;
+        }
 
-    std::cout << "Converted " << argv[1] << " (" << width << "x" << height << " RGB)\n";
-    std::cout << "       -> " << argv[2] << " (" << width << "x" << height << " grayscale)\n";
+        std::cout << "Converted " << argv[1] << " (" << width << "x" << height << " RGB)\n";
+        std::cout << "       -> " << argv[2] << " (" << width << "x" << height << " grayscale)\n";
+        ++images;
+    }
+
+    if (!reader.error().empty()) {
+        std::cerr << "Error: " << reader.error() << " in " << argv[1] << "\n";
+        return 1;
+    }
+    if (images == 0) {
+        std::cerr << "Error: No image in " << argv[1] << "\n";
+        return 1;
+    }
+    if (!writer.close()) {
+        std::cerr << "Error: " << writer.error() << "\n";
+        return 1;
+    }
 
     return 0;
-}
\ No newline at end of file
+}